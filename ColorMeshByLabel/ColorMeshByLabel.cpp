@@ -2,20 +2,25 @@
 #include <iostream>
 #include <CGAL/boost/graph/IO/OBJ.h>
 #include "../Polyhedron.h"
+#include "../Profiler.h"
 #include "CGAL/Simple_cartesian.h"
 
 bool ColorMeshByLabel( std::string input_file, std::string input_labels, std::string output_file )
 {
     std::vector<CGAL::Simple_cartesian<double>::Point_3> vertices;
     std::vector<TTriangle<size_t>> indices;
-    LoadVFAssimp<CGAL::Simple_cartesian<double>, size_t>(input_file, vertices, indices);
-    
-    auto labels = LoadLabels(input_labels);
+    std::vector<int> labels;
+    {
+        ORTHO_PROFILE_SCOPE("load");
+        LoadVFAssimp<CGAL::Simple_cartesian<double>, size_t>(input_file, vertices, indices);
+        labels = LoadLabels(input_labels);
+    }
     if(vertices.size() != labels.size())
     {
         std::cout << "Error: number of vertices != number of labels." << std::endl;
         return false;
     }
+    ORTHO_PROFILE_SCOPE("write");
     WriteVFAssimp<CGAL::Simple_cartesian<double>, size_t>(output_file, vertices, indices, labels);
     return true;
 }
@@ -26,6 +31,7 @@ int main(int argc, char* argv[])
     std::string input;
     std::string labels;
     std::string output;
+    std::string trace;
 
     for(int i = 1; i < argc; i++)
     {
@@ -41,12 +47,17 @@ int main(int argc, char* argv[])
         {
             output = std::string(argv[i+1]);
         }
+        else if(std::strcmp(argv[i], "-trace") == 0)
+        {
+            trace = std::string(argv[i+1]);
+        }
     }
 
     std::cout << "input: " << input << std::endl;
     std::cout << "labels: " << labels << std::endl;
     std::cout << "output: " << output << std::endl;
 
+    Profiler::Session session(trace);
     if(ColorMeshByLabel(input, labels, output))
     {
         return 0;
@@ -0,0 +1,186 @@
+#ifndef COMPONENTS_H
+#define COMPONENTS_H
+#include <atomic>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include <boost/graph/graph_traits.hpp>
+#include <CGAL/boost/graph/iterator.h>
+
+namespace internal
+{
+// Union-find that can be updated from several threads. Roots are always the smallest index of their set,
+// so parent links only point downwards and no cycle can appear between concurrent unions.
+class ConcurrentUnionFind
+{
+public:
+    explicit ConcurrentUnionFind(size_t n) : _parent(n)
+    {
+        for(size_t i = 0; i < n; i++)
+        {
+            _parent[i].store(i, std::memory_order_relaxed);
+        }
+    }
+
+    size_t Find(size_t x)
+    {
+        while(true)
+        {
+            size_t p = _parent[x].load();
+            if(p == x)
+                return x;
+            size_t gp = _parent[p].load();
+            if(p != gp)
+            {
+                // path halving, fine to lose the race.
+                _parent[x].compare_exchange_weak(p, gp);
+            }
+            x = gp;
+        }
+    }
+
+    void Unite(size_t a, size_t b)
+    {
+        while(true)
+        {
+            a = Find(a);
+            b = Find(b);
+            if(a == b)
+                return;
+            if(a < b)
+                std::swap(a, b);
+            size_t expected = a;
+            if(_parent[a].compare_exchange_strong(expected, b))
+                return;
+        }
+    }
+
+protected:
+    std::vector<std::atomic<size_t>> _parent;
+};
+}
+
+// Result of a component labeling. Components are numbered by the smallest index of their elements,
+// which is the order a sequential scan over the mesh would find them in.
+struct ComponentLabeling
+{
+    std::vector<size_t> _ids;   // component of each element
+    std::vector<size_t> _sizes; // number of elements in each component
+
+    size_t Count() const { return _sizes.size(); }
+
+    // Elements of each component, in mesh order. `elements` must list the elements by index.
+    template <typename Handle>
+    std::vector<std::vector<Handle>> Group(const std::vector<Handle>& elements) const
+    {
+        std::vector<std::vector<Handle>> groups(_sizes.size());
+        for(size_t i = 0; i < groups.size(); i++)
+        {
+            groups[i].reserve(_sizes[i]);
+        }
+        for(size_t i = 0; i < elements.size(); i++)
+        {
+            groups[_ids[i]].push_back(elements[i]);
+        }
+        return groups;
+    }
+
+    // Same as Group, but only the elements accepted by keep are grouped, and components left empty are
+    // dropped.
+    template <typename Handle, typename Keep>
+    std::vector<std::vector<Handle>> Group(const std::vector<Handle>& elements, Keep keep) const
+    {
+        std::vector<size_t> index(_sizes.size(), SIZE_MAX);
+        std::vector<std::vector<Handle>> groups;
+        for(size_t i = 0; i < elements.size(); i++)
+        {
+            if(!keep(elements[i]))
+                continue;
+            size_t& g = index[_ids[i]];
+            if(g == SIZE_MAX)
+            {
+                g = groups.size();
+                groups.emplace_back();
+                groups.back().reserve(_sizes[_ids[i]]);
+            }
+            groups[g].push_back(elements[i]);
+        }
+        return groups;
+    }
+};
+
+namespace internal
+{
+inline ComponentLabeling CompactComponents(ConcurrentUnionFind& uf, size_t n)
+{
+    ComponentLabeling result;
+    result._ids.resize(n);
+#pragma omp parallel for
+    for(int i = 0; i < n; i++)
+    {
+        result._ids[i] = uf.Find(i);
+    }
+    std::vector<size_t> dense(n);
+    for(size_t i = 0; i < n; i++)
+    {
+        if(result._ids[i] == i)
+        {
+            dense[i] = result._sizes.size();
+            result._sizes.push_back(0);
+        }
+    }
+    for(size_t i = 0; i < n; i++)
+    {
+        result._ids[i] = dense[result._ids[i]];
+        result._sizes[result._ids[i]]++;
+    }
+    return result;
+}
+}
+
+// Components of the vertex graph, where two adjacent vertices are joined if same_component(v0, v1) holds.
+// Vertex ids must be set (CGAL::set_halfedgeds_items_id) and match the iteration order.
+template <typename Polyhedron, typename Pred>
+ComponentLabeling VertexComponents(const Polyhedron& mesh, Pred same_component)
+{
+    using vertex_descriptor = typename boost::graph_traits<Polyhedron>::vertex_descriptor;
+    std::vector<vertex_descriptor> vertices(CGAL::vertices(mesh).begin(), CGAL::vertices(mesh).end());
+    internal::ConcurrentUnionFind uf(vertices.size());
+#pragma omp parallel for
+    for(int i = 0; i < vertices.size(); i++)
+    {
+        for(auto nei : CGAL::vertices_around_target(vertices[i], mesh))
+        {
+            if(nei->id() > i && same_component(vertices[i], nei))
+            {
+                uf.Unite(i, nei->id());
+            }
+        }
+    }
+    return internal::CompactComponents(uf, vertices.size());
+}
+
+// Components of the face graph, where two faces sharing an edge are joined if same_component(f0, f1) holds.
+// Face ids must be set (CGAL::set_halfedgeds_items_id) and match the iteration order.
+template <typename Polyhedron, typename Pred>
+ComponentLabeling FaceComponents(const Polyhedron& mesh, Pred same_component)
+{
+    using face_descriptor = typename boost::graph_traits<Polyhedron>::face_descriptor;
+    std::vector<face_descriptor> faces(CGAL::faces(mesh).begin(), CGAL::faces(mesh).end());
+    internal::ConcurrentUnionFind uf(faces.size());
+#pragma omp parallel for
+    for(int i = 0; i < faces.size(); i++)
+    {
+        for(auto hh : CGAL::halfedges_around_face(CGAL::halfedge(faces[i], mesh), mesh))
+        {
+            auto nei = CGAL::face(CGAL::opposite(hh, mesh), mesh);
+            if(nei != boost::graph_traits<Polyhedron>::null_face() && nei->id() > i && same_component(faces[i], nei))
+            {
+                uf.Unite(i, nei->id());
+            }
+        }
+    }
+    return internal::CompactComponents(uf, faces.size());
+}
+
+#endif
@@ -0,0 +1,113 @@
+#ifndef CURVE_SMOOTHING_H
+#define CURVE_SMOOTHING_H
+#include <array>
+#include <initializer_list>
+#include <iterator>
+#include <span>
+#include <utility>
+#include <vector>
+
+// Closed polyline stored as one array per coordinate, for smoothing. Each smoothing step reads the current
+// arrays and writes a second set that is then swapped in, so repeated steps do not allocate, and the
+// per-point update is a plain loop over contiguous doubles that vectorizes.
+template <typename FT = double>
+class TClosedPolyline
+{
+public:
+    TClosedPolyline() = default;
+
+    template <typename Iterator>
+    TClosedPolyline(Iterator first, Iterator last)
+    {
+        Assign(first, last);
+    }
+
+    size_t size() const { return _coords[0].size(); }
+    // Coordinates of all points along one axis, valid until the next step.
+    std::span<FT> Coords(int axis) { return _coords[axis]; }
+
+    // Resize, keeping the capacity of both buffers.
+    void Resize(size_t n)
+    {
+        for(int axis = 0; axis < 3; axis++)
+        {
+            _coords[axis].resize(n);
+            _buffer[axis].resize(n);
+        }
+    }
+
+    template <typename Point>
+    void Set(size_t i, const Point& p)
+    {
+        _coords[0][i] = static_cast<FT>(p.x());
+        _coords[1][i] = static_cast<FT>(p.y());
+        _coords[2][i] = static_cast<FT>(p.z());
+    }
+
+    template <typename Point>
+    Point Get(size_t i) const
+    {
+        return Point(_coords[0][i], _coords[1][i], _coords[2][i]);
+    }
+
+    template <typename Iterator>
+    void Assign(Iterator first, Iterator last)
+    {
+        Resize(std::distance(first, last));
+        for(size_t i = 0; first != last; first++, i++)
+        {
+            Set(i, *first);
+        }
+    }
+
+    template <typename Iterator>
+    void CopyTo(Iterator out) const
+    {
+        using Point = typename std::iterator_traits<Iterator>::value_type;
+        for(size_t i = 0; i < size(); i++, out++)
+        {
+            *out = Get<Point>(i);
+        }
+    }
+
+    // Move each point by lambda times its offset to the midpoint of its neighbors. lambda = 1 replaces the
+    // points by the midpoints.
+    void Laplacian(FT lambda, int iterations = 1)
+    {
+        for(int i = 0; i < iterations; i++)
+        {
+            Step(lambda);
+        }
+    }
+
+protected:
+    void Step(FT factor)
+    {
+        const size_t n = size();
+        if(n == 0)
+        {
+            return;
+        }
+        for(int axis = 0; axis < 3; axis++)
+        {
+            const FT* in = _coords[axis].data();
+            FT* out = _buffer[axis].data();
+            // the two ends wrap around, the rest has both neighbors in place.
+            for(size_t i : { size_t(0), n - 1 })
+            {
+                out[i] = in[i] + factor * (FT(0.5) * (in[(i + n - 1) % n] + in[(i + 1) % n]) - in[i]);
+            }
+#pragma omp simd
+            for(size_t i = 1; i < n - 1; i++)
+            {
+                out[i] = in[i] + factor * (FT(0.5) * (in[i - 1] + in[i + 1]) - in[i]);
+            }
+            std::swap(_coords[axis], _buffer[axis]);
+        }
+    }
+
+    std::array<std::vector<FT>, 3> _coords;
+    std::array<std::vector<FT>, 3> _buffer;
+};
+
+#endif
@@ -0,0 +1,456 @@
+#ifndef FLAT_BVH_H
+#define FLAT_BVH_H
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <numeric>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+#include <CGAL/Bbox_3.h>
+#include <CGAL/boost/graph/properties.h>
+#include <CGAL/intersections.h>
+#include "MeshCache.h"
+#include "Profiler.h"
+
+namespace internal
+{
+// Closest point to p on triangle (a, b, c) and its squared distance. Written without early returns so the
+// region selection can be if-converted when called from a simd loop. (Ericson, Real-Time Collision Detection 5.1.5)
+template <typename FT>
+inline FT ClosestOnTriangle(FT px, FT py, FT pz,
+    FT ax, FT ay, FT az, FT bx, FT by, FT bz, FT cx, FT cy, FT cz,
+    FT& qx, FT& qy, FT& qz)
+{
+    FT abx = bx - ax, aby = by - ay, abz = bz - az;
+    FT acx = cx - ax, acy = cy - ay, acz = cz - az;
+    FT apx = px - ax, apy = py - ay, apz = pz - az;
+    FT bpx = px - bx, bpy = py - by, bpz = pz - bz;
+    FT cpx = px - cx, cpy = py - cy, cpz = pz - cz;
+    FT d1 = abx * apx + aby * apy + abz * apz;
+    FT d2 = acx * apx + acy * apy + acz * apz;
+    FT d3 = abx * bpx + aby * bpy + abz * bpz;
+    FT d4 = acx * bpx + acy * bpy + acz * bpz;
+    FT d5 = abx * cpx + aby * cpy + abz * cpz;
+    FT d6 = acx * cpx + acy * cpy + acz * cpz;
+    FT va = d3 * d6 - d5 * d4;
+    FT vb = d5 * d2 - d1 * d6;
+    FT vc = d1 * d4 - d3 * d2;
+    FT v, w;
+    if(d1 <= 0 && d2 <= 0)
+    {
+        v = 0; w = 0;
+    }
+    else if(d3 >= 0 && d4 <= d3)
+    {
+        v = 1; w = 0;
+    }
+    else if(d6 >= 0 && d5 <= d6)
+    {
+        v = 0; w = 1;
+    }
+    else if(vc <= 0 && d1 >= 0 && d3 <= 0)
+    {
+        v = d1 / (d1 - d3); w = 0;
+    }
+    else if(vb <= 0 && d2 >= 0 && d6 <= 0)
+    {
+        v = 0; w = d2 / (d2 - d6);
+    }
+    else if(va <= 0 && d4 - d3 >= 0 && d5 - d6 >= 0)
+    {
+        w = (d4 - d3) / ((d4 - d3) + (d5 - d6)); v = 1 - w;
+    }
+    else
+    {
+        FT denom = FT(1) / (va + vb + vc);
+        v = vb * denom; w = vc * denom;
+    }
+    qx = ax + abx * v + acx * w;
+    qy = ay + aby * v + acy * w;
+    qz = az + abz * v + acz * w;
+    FT dx = px - qx, dy = py - qy, dz = pz - qz;
+    return dx * dx + dy * dy + dz * dz;
+}
+}
+
+// Bounding volume hierarchy over the triangles of a Polyhedron, stored as flat arrays: nodes in depth-first
+// order with both child boxes in the parent, and triangle coordinates in structure-of-arrays order so leaf
+// tests run as simd loops without touching the halfedge structure. Faces are kept to map results back.
+// Offers the subset of the CGAL::AABB_tree interface used in this project, so either can be used as AABBTree.
+// FT is the coordinate type of the stored triangles; queries and results are in the kernel's type.
+template <typename Polyhedron, typename FT = double>
+class FlatBVH
+{
+public:
+    using Kernel = typename Polyhedron::Traits;
+    using Point = typename Kernel::Point_3;
+    using Point_3 = Point;
+    using Primitive_id = typename Polyhedron::Facet_handle;
+    using Point_and_primitive_id = std::pair<Point, Primitive_id>;
+    static constexpr uint32_t kLeafSize = 8;
+    // Size of the traversal stacks. Each level of the tree adds at most one entry, so trees built here, which
+    // are balanced, stay far below it.
+    static constexpr int kStackSize = 64;
+
+    // Tree over the faces [first, last) of mesh. Like CGAL::AABB_face_graph_triangle_primitive, the triangles are
+    // read through the vertex point map of mesh.
+    template <typename FaceIterator>
+    FlatBVH(FaceIterator first, FaceIterator last, const Polyhedron& mesh)
+        : _faces(first, last)
+    {
+        Build(mesh);
+    }
+
+    // Tree stored by Sections() for the same mesh. Face ids must be set.
+    FlatBVH(const Polyhedron& mesh, const std::vector<std::span<const std::byte>>& sections)
+    {
+        const size_t n = sections.size() == 11 ? sections[10].size() / sizeof(uint32_t) : 0;
+        if(sections.size() != 11 || sections[0].size() % sizeof(Node) != 0 || (n > 0) != (sections[0].size() > 0)
+            || sections[10].size() != n * sizeof(uint32_t))
+        {
+            throw IOError("Invalid cached BVH");
+        }
+        auto arrays = CoordinateArrays();
+        for(int a = 0; a < 9; a++)
+        {
+            if(sections[1 + a].size() != n * sizeof(FT))
+                throw IOError("Invalid cached BVH");
+            arrays[a]->resize(n);
+            std::memcpy(arrays[a]->data(), sections[1 + a].data(), n * sizeof(FT));
+        }
+        _nodes.resize(sections[0].size() / sizeof(Node));
+        std::memcpy(_nodes.data(), sections[0].data(), sections[0].size());
+        std::vector<Primitive_id> all_faces(mesh.size_of_facets());
+        for(auto hf = mesh.facets_begin(); hf != mesh.facets_end(); hf++)
+        {
+            all_faces[hf->id()] = hf;
+        }
+        std::vector<uint32_t> ids(n);
+        std::memcpy(ids.data(), sections[10].data(), n * sizeof(uint32_t));
+        _faces.resize(n);
+        for(size_t i = 0; i < n; i++)
+        {
+            if(ids[i] >= all_faces.size())
+                throw IOError("Invalid cached BVH");
+            _faces[i] = all_faces[ids[i]];
+        }
+        // children follow their parent in depth-first order
+        std::vector<int> depth(_nodes.size(), 0);
+        for(size_t i = 0; i < _nodes.size(); i++)
+        {
+            const Node& node = _nodes[i];
+            bool valid = node._count > 0 ? node._count <= kLeafSize && size_t(node._first) + node._count <= n
+                : node._child[0] > i && node._child[1] > i && node._child[0] < _nodes.size() && node._child[1] < _nodes.size();
+            if(!valid || depth[i] + 2 > kStackSize)
+                throw IOError("Invalid cached BVH");
+            if(node._count == 0)
+            {
+                depth[node._child[0]] = std::max(depth[node._child[0]], depth[i] + 1);
+                depth[node._child[1]] = std::max(depth[node._child[1]], depth[i] + 1);
+            }
+        }
+    }
+
+    // Raw arrays of the tree for a MeshCache entry: nodes, the nine coordinate arrays, and the face ids in
+    // leaf order, which are written to face_ids. Face ids must be set.
+    std::vector<std::span<const std::byte>> Sections(std::vector<uint32_t>& face_ids) const
+    {
+        face_ids.resize(_faces.size());
+        for(size_t i = 0; i < _faces.size(); i++)
+        {
+            face_ids[i] = static_cast<uint32_t>(_faces[i]->id());
+        }
+        std::vector<std::span<const std::byte>> sections;
+        sections.push_back(std::as_bytes(std::span<const Node>(_nodes)));
+        for(const std::vector<FT>* a : { &_ax, &_ay, &_az, &_bx, &_by, &_bz, &_cx, &_cy, &_cz })
+        {
+            sections.push_back(std::as_bytes(std::span<const FT>(*a)));
+        }
+        sections.push_back(std::as_bytes(std::span<const uint32_t>(face_ids)));
+        return sections;
+    }
+
+    bool empty() const { return _faces.empty(); }
+    size_t size() const { return _faces.size(); }
+    // Built in the constructor; kept for interface compatibility with CGAL::AABB_tree.
+    void build() {}
+    void accelerate_distance_queries() const {}
+
+    // On an empty tree p itself is returned, with a null face.
+    Point_and_primitive_id closest_point_and_primitive(const Point& p) const
+    {
+        if(_nodes.empty())
+        {
+            return { p, Primitive_id() };
+        }
+        FT px = static_cast<FT>(p.x()), py = static_cast<FT>(p.y()), pz = static_cast<FT>(p.z());
+        FT best = std::numeric_limits<FT>::max();
+        uint32_t best_i = 0;
+        FT bx = 0, by = 0, bz = 0;
+
+        std::array<std::pair<uint32_t, FT>, kStackSize> stack;
+        int top = 0;
+        stack[top++] = { 0, FT(0) };
+        while(top > 0)
+        {
+            auto [n, d] = stack[--top];
+            if(d >= best)
+                continue;
+            const Node& node = _nodes[n];
+            if(node._count > 0)
+            {
+                FT dist[kLeafSize], qx[kLeafSize], qy[kLeafSize], qz[kLeafSize];
+                const uint32_t b = node._first;
+#pragma omp simd
+                for(uint32_t k = 0; k < node._count; k++)
+                {
+                    dist[k] = internal::ClosestOnTriangle(px, py, pz,
+                        _ax[b + k], _ay[b + k], _az[b + k], _bx[b + k], _by[b + k], _bz[b + k], _cx[b + k], _cy[b + k], _cz[b + k],
+                        qx[k], qy[k], qz[k]);
+                }
+                for(uint32_t k = 0; k < node._count; k++)
+                {
+                    if(dist[k] < best)
+                    {
+                        best = dist[k];
+                        best_i = b + k;
+                        bx = qx[k]; by = qy[k]; bz = qz[k];
+                    }
+                }
+                continue;
+            }
+            FT cd[2];
+#pragma omp simd
+            for(int c = 0; c < 2; c++)
+            {
+                FT dx = std::max(std::max(node._lo[0][c] - px, px - node._hi[0][c]), FT(0));
+                FT dy = std::max(std::max(node._lo[1][c] - py, py - node._hi[1][c]), FT(0));
+                FT dz = std::max(std::max(node._lo[2][c] - pz, pz - node._hi[2][c]), FT(0));
+                cd[c] = dx * dx + dy * dy + dz * dz;
+            }
+            // push the farther child first so the nearer one is visited next.
+            int nearer = cd[0] <= cd[1] ? 0 : 1;
+            if(cd[1 - nearer] < best)
+                stack[top++] = { node._child[1 - nearer], cd[1 - nearer] };
+            if(cd[nearer] < best)
+                stack[top++] = { node._child[nearer], cd[nearer] };
+        }
+        return { Point(bx, by, bz), _faces[best_i] };
+    }
+
+    Point closest_point(const Point& p) const
+    {
+        return closest_point_and_primitive(p).first;
+    }
+
+    // Faces intersected by query, which can be any object with bbox() and a CGAL::do_intersect with Triangle_3.
+    template <typename Query, typename OutputIterator>
+    OutputIterator all_intersected_primitives(const Query& query, OutputIterator out) const
+    {
+        if(_nodes.empty())
+        {
+            return out;
+        }
+        CGAL::Bbox_3 box = query.bbox();
+        std::array<uint32_t, kStackSize> stack;
+        int top = 0;
+        stack[top++] = 0;
+        while(top > 0)
+        {
+            const Node& node = _nodes[stack[--top]];
+            if(node._count > 0)
+            {
+                for(uint32_t k = node._first; k < node._first + node._count; k++)
+                {
+                    if(CGAL::do_overlap(box, TriangleBox(k)) && CGAL::do_intersect(query, Triangle(k)))
+                    {
+                        *out++ = _faces[k];
+                    }
+                }
+                continue;
+            }
+            for(int c = 0; c < 2; c++)
+            {
+                if(box.xmin() <= node._hi[0][c] && box.xmax() >= node._lo[0][c] &&
+                   box.ymin() <= node._hi[1][c] && box.ymax() >= node._lo[1][c] &&
+                   box.zmin() <= node._hi[2][c] && box.zmax() >= node._lo[2][c])
+                {
+                    stack[top++] = node._child[c];
+                }
+            }
+        }
+        return out;
+    }
+
+protected:
+    struct Node
+    {
+        // boxes of the two children, [axis][child]
+        FT _lo[3][2];
+        FT _hi[3][2];
+        uint32_t _child[2] = { 0, 0 };
+        uint32_t _first = 0;
+        uint32_t _count = 0; // > 0 for leaves
+    };
+
+    typename Kernel::Triangle_3 Triangle(uint32_t i) const
+    {
+        auto hh = _faces[i]->halfedge();
+        return typename Kernel::Triangle_3(hh->vertex()->point(), hh->next()->vertex()->point(), hh->prev()->vertex()->point());
+    }
+
+    std::array<std::vector<FT>*, 9> CoordinateArrays()
+    {
+        return { &_ax, &_ay, &_az, &_bx, &_by, &_bz, &_cx, &_cy, &_cz };
+    }
+
+    CGAL::Bbox_3 TriangleBox(uint32_t i) const
+    {
+        return CGAL::Bbox_3(
+            std::min({ _ax[i], _bx[i], _cx[i] }), std::min({ _ay[i], _by[i], _cy[i] }), std::min({ _az[i], _bz[i], _cz[i] }),
+            std::max({ _ax[i], _bx[i], _cx[i] }), std::max({ _ay[i], _by[i], _cy[i] }), std::max({ _az[i], _bz[i], _cz[i] }));
+    }
+
+    void Build(const Polyhedron& mesh)
+    {
+        const size_t n = _faces.size();
+        std::vector<std::array<FT, 9>> tris(n);
+        std::vector<std::array<FT, 3>> centroids(n);
+        auto vpm = get(CGAL::vertex_point, mesh);
+        for(size_t i = 0; i < n; i++)
+        {
+            auto hh = halfedge(_faces[i], mesh);
+            const Point v[3] = { get(vpm, target(hh, mesh)), get(vpm, target(next(hh, mesh), mesh)), get(vpm, target(prev(hh, mesh), mesh)) };
+            for(int j = 0; j < 3; j++)
+            {
+                for(int axis = 0; axis < 3; axis++)
+                {
+                    tris[i][j * 3 + axis] = static_cast<FT>(v[j][axis]);
+                }
+            }
+            for(int axis = 0; axis < 3; axis++)
+            {
+                centroids[i][axis] = (tris[i][axis] + tris[i][3 + axis] + tris[i][6 + axis]) / FT(3);
+            }
+        }
+        std::vector<uint32_t> order(n);
+        std::iota(order.begin(), order.end(), 0);
+        _nodes.clear();
+        _nodes.reserve(n / kLeafSize * 2 + 1);
+        if(n > 0)
+        {
+            std::array<FT, 6> box;
+            BuildNode(order, 0, n, tris, centroids, box);
+        }
+
+        // store triangles in leaf order
+        std::vector<Primitive_id> faces(n);
+        for(auto* a : CoordinateArrays())
+        {
+            a->resize(n);
+        }
+        for(size_t i = 0; i < n; i++)
+        {
+            const auto& t = tris[order[i]];
+            _ax[i] = t[0]; _ay[i] = t[1]; _az[i] = t[2];
+            _bx[i] = t[3]; _by[i] = t[4]; _bz[i] = t[5];
+            _cx[i] = t[6]; _cy[i] = t[7]; _cz[i] = t[8];
+            faces[i] = _faces[order[i]];
+        }
+        _faces = std::move(faces);
+    }
+
+    // Build the subtree over order[begin, end) and return its index; box receives its bounds (lo xyz, hi xyz).
+    uint32_t BuildNode(std::vector<uint32_t>& order, size_t begin, size_t end,
+        const std::vector<std::array<FT, 9>>& tris, const std::vector<std::array<FT, 3>>& centroids, std::array<FT, 6>& box)
+    {
+        box = { std::numeric_limits<FT>::max(), std::numeric_limits<FT>::max(), std::numeric_limits<FT>::max(),
+                std::numeric_limits<FT>::lowest(), std::numeric_limits<FT>::lowest(), std::numeric_limits<FT>::lowest() };
+        std::array<FT, 6> cbox = box;
+        for(size_t i = begin; i < end; i++)
+        {
+            for(int axis = 0; axis < 3; axis++)
+            {
+                for(int j = 0; j < 3; j++)
+                {
+                    box[axis] = std::min(box[axis], tris[order[i]][j * 3 + axis]);
+                    box[3 + axis] = std::max(box[3 + axis], tris[order[i]][j * 3 + axis]);
+                }
+                cbox[axis] = std::min(cbox[axis], centroids[order[i]][axis]);
+                cbox[3 + axis] = std::max(cbox[3 + axis], centroids[order[i]][axis]);
+            }
+        }
+        uint32_t id = static_cast<uint32_t>(_nodes.size());
+        _nodes.emplace_back();
+        if(end - begin <= kLeafSize)
+        {
+            _nodes[id]._first = static_cast<uint32_t>(begin);
+            _nodes[id]._count = static_cast<uint32_t>(end - begin);
+            return id;
+        }
+        // median split on the longest axis of the centroid bounds
+        int axis = 0;
+        for(int a = 1; a < 3; a++)
+        {
+            if(cbox[3 + a] - cbox[a] > cbox[3 + axis] - cbox[axis])
+                axis = a;
+        }
+        size_t mid = (begin + end) / 2;
+        std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+            [&](uint32_t l, uint32_t r) { return centroids[l][axis] < centroids[r][axis]; });
+        std::array<FT, 6> child_box[2];
+        uint32_t left = BuildNode(order, begin, mid, tris, centroids, child_box[0]);
+        uint32_t right = BuildNode(order, mid, end, tris, centroids, child_box[1]);
+        Node& node = _nodes[id];
+        node._child[0] = left;
+        node._child[1] = right;
+        for(int c = 0; c < 2; c++)
+        {
+            for(int a = 0; a < 3; a++)
+            {
+                node._lo[a][c] = child_box[c][a];
+                node._hi[a][c] = child_box[c][3 + a];
+            }
+        }
+        return id;
+    }
+
+    std::vector<Primitive_id> _faces;
+    std::vector<Node> _nodes;
+    std::vector<FT> _ax, _ay, _az, _bx, _by, _bz, _cx, _cy, _cz;
+};
+
+// Tree over all faces of mesh, taken from the default MeshCache if it holds one for this mesh, and stored
+// there otherwise. Vertex and face ids must be set.
+template <typename Polyhedron, typename FT = double>
+FlatBVH<Polyhedron, FT> CachedFlatBVH(const Polyhedron& mesh)
+{
+    ORTHO_PROFILE_SCOPE("flat_bvh");
+    MeshCache* cache = MeshCache::Default();
+    if(cache == nullptr)
+    {
+        return FlatBVH<Polyhedron, FT>(mesh.facets_begin(), mesh.facets_end(), mesh);
+    }
+    const uint64_t key = MeshHash(mesh);
+    const std::string kind = "flatbvh" + std::to_string(sizeof(FT) * 8);
+    if(auto entry = cache->Load(key, kind))
+    {
+        try
+        {
+            return FlatBVH<Polyhedron, FT>(mesh, entry->_sections);
+        }
+        catch(const IOError&)
+        {
+        }
+    }
+    FlatBVH<Polyhedron, FT> tree(mesh.facets_begin(), mesh.facets_end(), mesh);
+    std::vector<uint32_t> face_ids;
+    cache->Store(key, kind, tree.Sections(face_ids));
+    return tree;
+}
+
+#endif
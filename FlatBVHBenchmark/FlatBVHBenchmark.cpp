@@ -0,0 +1,145 @@
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include <CGAL/AABB_tree.h>
+#include <CGAL/AABB_face_graph_triangle_primitive.h>
+#include <CGAL/AABB_traits.h>
+#include <CGAL/boost/graph/IO/polygon_mesh_io.h>
+#include <CGAL/Exact_predicates_inexact_constructions_kernel.h>
+#include "../Polyhedron.h"
+#include "../Projection.h"
+#include "../FlatBVH.h"
+
+// Compares CGAL::AABB_tree and FlatBVH on the queries used by GumTrimLine and ReSegment.
+namespace
+{
+using KernelEpick = CGAL::Exact_predicates_inexact_constructions_kernel;
+using Polyhedron = TPolyhedronWithLabel<ItemsWithLabelFlag, KernelEpick>;
+using Point_3 = KernelEpick::Point_3;
+using Triangle_3 = KernelEpick::Triangle_3;
+using AABBPrimitive = CGAL::AABB_face_graph_triangle_primitive<Polyhedron>;
+using AABBTraits = CGAL::AABB_traits<KernelEpick, AABBPrimitive>;
+using AABBTree = CGAL::AABB_tree<AABBTraits>;
+using FlatTree = FlatBVH<Polyhedron>;
+
+template <typename Func>
+double Seconds(Func func)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    func();
+    std::chrono::duration<double> d = std::chrono::high_resolution_clock::now() - start;
+    return d.count();
+}
+
+template <typename Tree>
+void RunQueries(const char* name, const Tree& tree, const std::vector<Point_3>& queries,
+    const std::vector<Triangle_3>& triangles, std::vector<Point_3>& result)
+{
+    result.resize(queries.size());
+    double serial = Seconds([&]() {
+        for(size_t i = 0; i < queries.size(); i++)
+        {
+            result[i] = tree.closest_point(queries[i]);
+        }
+    });
+    double batched = Seconds([&]() {
+        BatchClosestPoints(tree, std::span<const Point_3>(queries), std::span<Point_3>(result));
+    });
+    size_t nb_hits = 0;
+    double intersect = Seconds([&]() {
+        std::vector<typename Tree::Primitive_id> hits;
+        for(auto& t : triangles)
+        {
+            hits.clear();
+            tree.all_intersected_primitives(t, std::back_inserter(hits));
+            nb_hits += hits.size();
+        }
+    });
+    printf("%s: closest point %.3fs serial, %.3fs batched; %zd triangle queries %.3fs (%zd hits)\n",
+        name, serial, batched, triangles.size(), intersect, nb_hits);
+}
+}
+
+int main(int argc, char* argv[])
+{
+    if(argc < 2)
+    {
+        std::cout << "usage: FlatBVHBenchmark <mesh> [nb_queries]" << std::endl;
+        return -1;
+    }
+    size_t nb_queries = argc > 2 ? std::stoul(argv[2]) : 100000;
+
+    Polyhedron mesh;
+    if(!CGAL::IO::read_polygon_mesh(std::string(argv[1]), mesh) || mesh.empty())
+    {
+        std::cout << "Error: cannot read mesh " << argv[1] << std::endl;
+        return -1;
+    }
+    printf("Mesh: V = %zd, F = %zd\n", mesh.size_of_vertices(), mesh.size_of_facets());
+
+    // Queries near the surface, like curve points during smoothing, and small triangles around them,
+    // like the cut faces of ReSegment.
+    std::vector<Point_3> queries;
+    std::vector<Triangle_3> triangles;
+    std::vector<Polyhedron::Facet_handle> faces;
+    for(auto hf : CGAL::faces(mesh))
+        faces.push_back(hf);
+    std::mt19937 rng(0);
+    std::uniform_int_distribution<size_t> pick(0, faces.size() - 1);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    std::normal_distribution<double> noise(0.0, 0.2);
+    for(size_t i = 0; i < nb_queries; i++)
+    {
+        auto hh = faces[pick(rng)]->halfedge();
+        auto& a = hh->vertex()->point();
+        auto& b = hh->next()->vertex()->point();
+        auto& c = hh->prev()->vertex()->point();
+        double u = unit(rng), v = unit(rng);
+        if(u + v > 1.0)
+        {
+            u = 1.0 - u;
+            v = 1.0 - v;
+        }
+        Point_3 p = a + (b - a) * u + (c - a) * v;
+        queries.push_back(p + KernelEpick::Vector_3(noise(rng), noise(rng), noise(rng)));
+        if(i % 10 == 0)
+        {
+            KernelEpick::Vector_3 d(noise(rng), noise(rng), noise(rng));
+            triangles.emplace_back(p, p + d, p + KernelEpick::Vector_3(-d.y(), d.x(), d.z()));
+        }
+    }
+
+    std::vector<Point_3> aabb_result;
+    std::vector<Point_3> flat_result;
+    {
+        std::unique_ptr<AABBTree> aabb_tree;
+        double t = Seconds([&]() {
+            aabb_tree = std::make_unique<AABBTree>(mesh.facets_begin(), mesh.facets_end(), mesh);
+            PrepareForProjection(*aabb_tree);
+        });
+        printf("AABB_tree: build %.3fs\n", t);
+        RunQueries("AABB_tree", *aabb_tree, queries, triangles, aabb_result);
+    }
+    {
+        std::unique_ptr<FlatTree> flat_tree;
+        double t = Seconds([&]() {
+            flat_tree = std::make_unique<FlatTree>(mesh.facets_begin(), mesh.facets_end(), mesh);
+        });
+        printf("FlatBVH: build %.3fs\n", t);
+        RunQueries("FlatBVH", *flat_tree, queries, triangles, flat_result);
+    }
+
+    double max_diff = 0.0;
+    for(size_t i = 0; i < queries.size(); i++)
+    {
+        double d0 = std::sqrt(CGAL::squared_distance(queries[i], aabb_result[i]));
+        double d1 = std::sqrt(CGAL::squared_distance(queries[i], flat_result[i]));
+        max_diff = std::max(max_diff, std::abs(d0 - d1));
+    }
+    printf("Max difference of closest distance: %g\n", max_diff);
+    return 0;
+}
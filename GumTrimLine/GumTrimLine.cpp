@@ -1,8 +1,19 @@
 #include <algorithm>
-#include <deque>
+#include <array>
+#include <cctype>
+#include <cstdint>
+#include <exception>
 #include <iostream>
 #include <filesystem>
+#include <limits>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <span>
 #include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <nlohmann/json.hpp>
 
 #include <CGAL/boost/graph/Face_filtered_graph.h>
 #include <CGAL/boost/graph/copy_face_graph.h>
@@ -11,7 +22,21 @@
 #include <CGAL/linear_least_squares_fitting_3.h>
 #include <CGAL/Polygon_mesh_processing/border.h>
 #include <CGAL/Polygon_mesh_processing/triangulate_hole.h>
+#include <CGAL/Surface_mesh_simplification/edge_collapse.h>
+#include <CGAL/Surface_mesh_simplification/Policies/Edge_collapse/Constrained_placement.h>
+#include <CGAL/Surface_mesh_simplification/Policies/Edge_collapse/Edge_count_ratio_stop_predicate.h>
+#include <CGAL/Surface_mesh_simplification/Policies/Edge_collapse/LindstromTurk_cost.h>
+#include <CGAL/Surface_mesh_simplification/Policies/Edge_collapse/LindstromTurk_placement.h>
 #include "../MeshFix/MeshFix.h"
+#include "../Components.h"
+#include "../CurveSmoothing.h"
+#include "../FlatBVH.h"
+#include "../LabelTransfer.h"
+#include "../MeshCache.h"
+#include "../ParallelJobs.h"
+#include "../Profiler.h"
+#include "../Projection.h"
+#include "../RegionOfInterest.h"
 #include "GumTrimLine.h"
 #include "../Ortho.h"
 
@@ -31,60 +56,6 @@ namespace
     using Point_3 = Polyhedron::Point_3;
     using Vec3 = Polyhedron::Traits::Vector_3;
 
-    std::vector<hVertex> ConnectedComponents(hVertex hv, Polyhedron &mesh)
-    {
-        std::vector<hVertex> vertices;
-        std::deque<hVertex> front;
-        front.push_back(hv);
-        vertices.push_back(hv);
-        hv->_processed = true;
-
-        while (!front.empty())
-        {
-            hVertex v = front.front();
-            front.pop_front();
-            for (auto nei : CGAL::vertices_around_target(v, mesh))
-            {
-                if (!nei->_processed && nei->_label != 0)
-                {
-                    front.push_back(nei);
-                    vertices.push_back(nei);
-                    nei->_processed = true;
-                }
-            }
-        }
-
-        return vertices;
-    }
-
-    std::vector<hFacet> FacialConnectedComponents(hFacet hf, Polyhedron &mesh, std::function<bool(hFacet)> pred)
-    {
-        std::vector<hFacet> faces;
-        std::deque<hFacet> front;
-
-        front.push_back(hf);
-        faces.push_back(hf);
-
-        hf->_processed = true;
-
-        while (!front.empty())
-        {
-            hFacet f = front.front();
-            front.pop_front();
-            for (auto nei : CGAL::faces_around_face(f->halfedge(), mesh))
-            {
-                if (nei != nullptr && !nei->_processed && pred(nei))
-                {
-                    front.push_back(nei);
-                    faces.push_back(nei);
-                    nei->_processed = true;
-                }
-            }
-        }
-
-        return faces;
-    }
-
     std::vector<hHalfedge> GetBorderCycle(hHalfedge border, Polyhedron &mesh)
     {
         std::vector<hHalfedge> borders;
@@ -195,282 +166,297 @@ namespace
         return true;
     }
 
-    void CloseHoles(Polyhedron &mesh)
-    {
-        std::vector<hHalfedge> border_halfedges;
-        CGAL::Polygon_mesh_processing::extract_boundary_cycles(mesh, std::back_inserter(border_halfedges));
-        for (auto hh : border_halfedges)
-        {
-            std::vector<hFacet> out_faces;
-            CGAL::Polygon_mesh_processing::triangulate_hole(mesh, hh, std::back_inserter(out_faces));
-        }
-    }
-
-    void LabelProcessing(Polyhedron& mesh)
+    // Compact trim line outputs. The trim line is a closed polyline: point i joins point i + 1 and the last
+    // point joins the first, so only the points and their labels are stored.
+    bool WriteTrimLineJson(const std::vector<Point_3>& points, const std::vector<int>& labels, const std::string& path)
     {
-        auto aabb = CGAL::bbox_3(mesh.points_begin(), mesh.points_end());
-        double threshold = std::max(aabb.x_span(), std::max(aabb.y_span(), aabb.z_span())) / 150.0;
-        
-        std::unordered_map<hVertex, int> new_label_set;
-        for(auto hv : CGAL::vertices(mesh))
+        nlohmann::json js;
+        js["closed"] = true;
+        js["points"] = nlohmann::json::array();
+        for(const auto& p : points)
         {
-            if(hv->_label != 0)
-            {
-                continue;
-            }
-            std::unordered_set<hVertex> neighbors;
-            std::unordered_set<int> labels;
-            std::queue<hVertex> q;
-            q.push(hv);
-            neighbors.insert(hv);
-            labels.insert(hv->_label);
-            while(!q.empty())
-            {
-                hVertex curr = q.front();
-                q.pop();
-                for(auto nei : CGAL::vertices_around_target(curr, mesh))
-                {
-                    if(neighbors.count(nei) == 0 && CGAL::squared_distance(nei->point(), hv->point()) < threshold * threshold)
-                    {
-                        neighbors.insert(nei);
-                        labels.insert(nei->_label);
-                        q.push(nei);
-                    }
-                }
-            }
-            if(labels.size() >= 3)
-            {
-                double nearest_dist = std::numeric_limits<double>::max();
-                hVertex nearest_hv = nullptr;
-                for(auto nei : neighbors)
-                {
-                    if(nei->_label == hv->_label)
-                    {
-                        continue;
-                    }
-                    double d = CGAL::squared_distance(nei->point(), hv->point());
-                    if(d < nearest_dist)
-                    {
-                        nearest_dist = d;
-                        nearest_hv = nei;
-                    }
-                }
-                new_label_set.insert({hv, nearest_hv->_label});
-            }
+            js["points"].push_back({ p.x(), p.y(), p.z() });
         }
-    
-        for(auto [hv, label] : new_label_set)
+        js["labels"] = labels;
+        std::ofstream ofs(path);
+        if(ofs.fail())
         {
-            hv->_label = label;
+            return false;
         }
+        ofs << js.dump();
+        return !ofs.fail();
     }
-}
 
-bool GumTrimLine(std::string input_file, std::string label_file, std::string frame_file, std::string output_file, int smooth, double fix_factor)
-{
-    Polyhedron mesh;
-    if (!CGAL::IO::read_polygon_mesh(input_file, mesh, CGAL::parameters::verbose(true)))
+    // float64 array of shape (N, 4): x, y, z and label of each point.
+    bool WriteTrimLineNpy(const std::vector<Point_3>& points, const std::vector<int>& labels, const std::string& path)
     {
-        try
+        std::string header = "{'descr': '<f8', 'fortran_order': False, 'shape': (" + std::to_string(points.size()) + ", 4), }";
+        // magic, version and header length take 10 bytes; the data starts 64-byte aligned.
+        header.append(63 - (10 + header.size()) % 64, ' ');
+        header += '\n';
+        std::vector<double> data;
+        data.reserve(points.size() * 4);
+        for(size_t i = 0; i < points.size(); i++)
         {
-            printf("possible invalid mesh, try fixing...\n");
-            std::vector<typename Polyhedron::Traits::Point_3> vertices;
-            std::vector<TTriangle<size_t>> faces;
-            if(input_file.ends_with(".obj"))
-            {
-                LoadVFObj<typename Polyhedron::Traits, size_t>(input_file, vertices, faces);
-            }
-            else
-            {
-                // TODO: add custom file loading function for more formats, since assimp cannot keep vertex order sometimes.
-                LoadVFAssimp<typename Polyhedron::Traits, size_t>(input_file, vertices, faces);
-            }
-            std::vector<int> labels = LoadLabels(label_file);
-            FixMeshWithLabel(vertices, faces, labels, mesh, false, 0, false, false, 0, 0, false, 10);
+            data.insert(data.end(), { points[i].x(), points[i].y(), points[i].z(), static_cast<double>(labels[i]) });
         }
-        catch(const std::exception&)
+        std::ofstream ofs(path, std::ios::binary);
+        if(ofs.fail())
         {
-            throw IOError("Cannot read mesh file or mesh invalid: " + input_file);
+            return false;
         }
+        const uint16_t header_size = static_cast<uint16_t>(header.size());
+        ofs.write("\x93NUMPY\x01\x00", 8);
+        ofs.write(reinterpret_cast<const char*>(&header_size), sizeof(header_size));
+        ofs.write(header.data(), header.size());
+        ofs.write(reinterpret_cast<const char*>(data.data()), data.size() * sizeof(double));
+        return !ofs.fail();
     }
-    else
-    {
-        mesh.LoadLabels(label_file);
-        //mesh.UpdateFaceLabels2();
-    }
-    if (!mesh.is_valid(false))
-    {
-        mesh.is_valid(true);
-        throw MeshError("Input mesh not valid: " + input_file);
-    }
-    if (!mesh.is_pure_triangle())
-    {
-        throw MeshError("Input mesh has non triangle face: " + input_file);
-    }
-
-    for(auto hv : CGAL::vertices(mesh))
-    {
-        if(hv->_label == 1)
-            hv->_label = 0;
-    }
-    std::unique_ptr<CrownFrames<typename Polyhedron::Traits>> crown_frames = nullptr;
-    if(!frame_file.empty())
-    {
-        crown_frames = std::make_unique<CrownFrames<typename Polyhedron::Traits>>(frame_file);
-    }
-    CGAL::set_halfedgeds_items_id(mesh);
-    printf("Load ortho scan mesh: V = %zd, F = %zd.\n", mesh.size_of_vertices(), mesh.size_of_facets());
-    
-    LabelProcessing(mesh);
-    mesh.UpdateFaceLabels2();
-    // mesh.WriteTriSoup("processed_mesh" + std::to_string(mesh.size_of_facets()) + ".obj");
 
-    using SubMesh = std::vector<hFacet>;
-    std::vector<SubMesh> components;
-    for (auto hf : CGAL::faces(mesh))
+    // "OTL1", uint32 point count, uint32 bytes per coordinate, the x, y, z of each point as FT, then one int32
+    // label per point. Little endian.
+    template <typename FT>
+    bool WriteTrimLineBinary(const std::vector<Point_3>& points, const std::vector<int>& labels, const std::string& path)
     {
-        if (!hf->_processed && hf->_label != 0)
+        std::vector<FT> coords;
+        coords.reserve(points.size() * 3);
+        for(const auto& p : points)
         {
-            components.emplace_back(FacialConnectedComponents(hf, mesh, [](hFacet nei){ return nei->_label != 0; }));
+            coords.insert(coords.end(), { static_cast<FT>(p.x()), static_cast<FT>(p.y()), static_cast<FT>(p.z()) });
         }
-        if(!hf->_processed && hf->_label == 0)
+        const std::vector<int32_t> labels32(labels.begin(), labels.end());
+        const uint32_t header[2] = { static_cast<uint32_t>(points.size()), static_cast<uint32_t>(sizeof(FT)) };
+        std::ofstream ofs(path, std::ios::binary);
+        if(ofs.fail())
         {
-            components.emplace_back(FacialConnectedComponents(hf, mesh, [](hFacet nei){ return nei->_label == 0; }));
+            return false;
         }
+        ofs.write("OTL1", 4);
+        ofs.write(reinterpret_cast<const char*>(header), sizeof(header));
+        ofs.write(reinterpret_cast<const char*>(coords.data()), coords.size() * sizeof(FT));
+        ofs.write(reinterpret_cast<const char*>(labels32.data()), labels32.size() * sizeof(int32_t));
+        return !ofs.fail();
     }
-    if (components.empty())
+
+    // Write the trim line in the format of the extension of path: .json, .npy, .bin (float32) or .bin64
+    // (float64). Any other extension gets the OBJ segment list without labels, as before.
+    bool WriteTrimLine(const std::vector<Point_3>& points, const std::vector<int>& labels, const std::string& path)
     {
-        throw AlgError("Cannot find gum part");
+        std::string ext = std::filesystem::path(path).extension().string();
+        std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return std::tolower(c); });
+        if(ext == ".json")
+            return WriteTrimLineJson(points, labels, path);
+        if(ext == ".npy")
+            return WriteTrimLineNpy(points, labels, path);
+        if(ext == ".bin")
+            return WriteTrimLineBinary<float>(points, labels, path);
+        if(ext == ".bin64")
+            return WriteTrimLineBinary<double>(points, labels, path);
+        return WritePoints(points, path);
     }
 
-    // clean components
-    std::vector<std::unordered_map<int, int>> comp_label_counts;
-    std::unordered_map<int, int> max_label_size;
-    std::array<bool, 50> label_exist;
-    std::fill(label_exist.begin(), label_exist.end(), false);
-    for(auto& comp : components)
+    void CloseHoles(Polyhedron &mesh)
     {
-        comp_label_counts.emplace_back();
-        for(auto hf : comp)
+        std::vector<hHalfedge> border_halfedges;
+        CGAL::Polygon_mesh_processing::extract_boundary_cycles(mesh, std::back_inserter(border_halfedges));
+        for (auto hh : border_halfedges)
         {
-            comp_label_counts.back()[hf->_label]++;
-            label_exist[hf->_label] = true;
+            std::vector<hFacet> out_faces;
+            CGAL::Polygon_mesh_processing::triangulate_hole(mesh, hh, std::back_inserter(out_faces));
         }
     }
-    for(auto& counts : comp_label_counts)
+
+    // Uniform grid over a point set answering fixed-radius queries. The cell size is the radius,
+    // so a query only visits the 27 cells around the query point.
+    class PointGrid
     {
-        for(auto& pair : counts)
+    public:
+        PointGrid(const std::vector<Point_3>& points, double radius)
+            : _points(points), _radius(radius), _bbox(CGAL::bbox_3(points.begin(), points.end()))
         {
-            max_label_size[pair.first] = std::max(max_label_size[pair.first], pair.second);
+            for(int axis = 0; axis < 3; axis++)
+            {
+                _dims[axis] = static_cast<int64_t>((_bbox.max(axis) - _bbox.min(axis)) / _radius) + 1;
+            }
+            _cells.resize(points.size());
+#pragma omp parallel for
+            for(int i = 0; i < points.size(); i++)
+            {
+                auto c = Coords(points[i]);
+                _cells[i] = { Key(c[0], c[1], c[2]), i };
+            }
+            std::sort(_cells.begin(), _cells.end());
         }
-    }
-    for(int i = 0; i < components.size(); i++)
-    {
-        std::unordered_set<int> label_to_remove;
-        for(auto& [label, cnt] : comp_label_counts[i])
+
+        // Call fn(index, squared distance) for every point strictly closer than the radius.
+        template <typename Fn>
+        void ForEachInRadius(const Point_3& p, Fn fn) const
         {
-            if(cnt != max_label_size[label])
+            auto c = Coords(p);
+            double r2 = _radius * _radius;
+            for(int64_t x = std::max<int64_t>(c[0] - 1, 0); x <= std::min(c[0] + 1, _dims[0] - 1); x++)
             {
-                label_to_remove.insert(label);
+                for(int64_t y = std::max<int64_t>(c[1] - 1, 0); y <= std::min(c[1] + 1, _dims[1] - 1); y++)
+                {
+                    for(int64_t z = std::max<int64_t>(c[2] - 1, 0); z <= std::min(c[2] + 1, _dims[2] - 1); z++)
+                    {
+                        uint64_t key = Key(x, y, z);
+                        auto it = std::lower_bound(_cells.begin(), _cells.end(), std::make_pair(key, size_t(0)));
+                        for(; it != _cells.end() && it->first == key; it++)
+                        {
+                            double d = CGAL::squared_distance(_points[it->second], p);
+                            if(d < r2)
+                            {
+                                fn(it->second, d);
+                            }
+                        }
+                    }
+                }
             }
         }
-        std::vector<hFacet> face_to_relabel;
-        for(auto hf : components[i])
+
+    protected:
+        std::array<int64_t, 3> Coords(const Point_3& p) const
         {
-            if(label_to_remove.count(hf->_label))
+            std::array<int64_t, 3> c;
+            for(int axis = 0; axis < 3; axis++)
             {
-                face_to_relabel.push_back(hf);
+                c[axis] = std::clamp<int64_t>(static_cast<int64_t>((p[axis] - _bbox.min(axis)) / _radius), 0, _dims[axis] - 1);
             }
+            return c;
         }
-        if(face_to_relabel.empty())
+
+        uint64_t Key(int64_t x, int64_t y, int64_t z) const
+        {
+            return static_cast<uint64_t>((x * _dims[1] + y) * _dims[2] + z);
+        }
+
+        const std::vector<Point_3>& _points;
+        double _radius;
+        CGAL::Bbox_3 _bbox;
+        std::array<int64_t, 3> _dims;
+        std::vector<std::pair<uint64_t, size_t>> _cells;
+    };
+
+    // Gum vertices close to at least two different teeth take the label of the nearest tooth.
+    void LabelProcessing(Polyhedron& mesh)
+    {
+        auto aabb = CGAL::bbox_3(mesh.points_begin(), mesh.points_end());
+        double threshold = std::max(aabb.x_span(), std::max(aabb.y_span(), aabb.z_span())) / 150.0;
+
+        const std::vector<hVertex> vertices(mesh.vertices_begin(), mesh.vertices_end());
+        std::vector<Point_3> points(vertices.size());
+        std::vector<int> labels(vertices.size());
+        for(size_t i = 0; i < vertices.size(); i++)
         {
-            continue;
+            points[i] = vertices[i]->point();
+            labels[i] = vertices[i]->_label;
         }
-        std::unordered_set<hFacet> surroundings;
-        for (auto hf : face_to_relabel)
+        PointGrid grid(points, threshold);
+
+        std::vector<int> new_labels = labels;
+#pragma omp parallel for schedule(dynamic, 256)
+        for(int i = 0; i < vertices.size(); i++)
         {
-            for (auto nei : CGAL::faces_around_face(hf->halfedge(), mesh))
+            if(labels[i] != 0)
             {
-                if(label_to_remove.count(nei->_label) == 0)
+                continue;
+            }
+            std::array<int, 3> distinct_labels;
+            int nb_labels = 0;
+            double nearest_dist = std::numeric_limits<double>::max();
+            int nearest_label = 0;
+            grid.ForEachInRadius(points[i], [&](size_t j, double d) {
+                int label = labels[j];
+                if(nb_labels < 3 && std::find(distinct_labels.begin(), distinct_labels.begin() + nb_labels, label) == distinct_labels.begin() + nb_labels)
+                {
+                    distinct_labels[nb_labels++] = label;
+                }
+                if(label != labels[i] && d < nearest_dist)
                 {
-                    surroundings.insert(nei);
+                    nearest_dist = d;
+                    nearest_label = label;
                 }
+            });
+            if(nb_labels >= 3)
+            {
+                new_labels[i] = nearest_label;
             }
         }
-        if(!surroundings.empty())
+
+        for(size_t i = 0; i < vertices.size(); i++)
         {
-            for (auto hf : face_to_relabel)
-            {
-                auto p = CGAL::centroid(hf->halfedge()->vertex()->point(), hf->halfedge()->next()->vertex()->point(), hf->halfedge()->prev()->vertex()->point());
-                auto nearest = *std::min_element(surroundings.begin(), surroundings.end(), [&](hFacet nei0, hFacet nei1) {
-                    auto nei0_p = CGAL::centroid(nei0->halfedge()->vertex()->point(), nei0->halfedge()->next()->vertex()->point(), nei0->halfedge()->prev()->vertex()->point());
-                    auto nei1_p = CGAL::centroid(nei1->halfedge()->vertex()->point(), nei1->halfedge()->next()->vertex()->point(), nei1->halfedge()->prev()->vertex()->point());
-                        return CGAL::squared_distance(p, nei0_p) < CGAL::squared_distance(p, nei1_p); });
-                hf->_label = nearest->_label;
-                hf->halfedge()->vertex()->_label = nearest->_label;
-                hf->halfedge()->next()->vertex()->_label = nearest->_label;
-                hf->halfedge()->prev()->vertex()->_label = nearest->_label;
-            }
+            vertices[i]->_label = new_labels[i];
         }
     }
 
-    // map face labels to vertex labels
-    for(auto hv : CGAL::vertices(mesh))
+    // Border cycles of the face set comp, traced on the mesh itself. Each cycle lists the halfedges outside comp
+    // whose opposite is inside, in the order of the border of the sub-mesh comp would form. At a vertex where
+    // comp touches itself, each border is continued with the next one around the vertex, so pinched borders
+    // are split into separate cycles. Returns false if a walk does not close, which needs the sub-mesh repair.
+    // Face ids must be set.
+    bool TraceBorderCycles(Polyhedron& mesh, const std::vector<hFacet>& comp, std::vector<std::vector<hHalfedge>>& cycles)
     {
-        int label = 0;
-        for(auto hf : CGAL::faces_around_target(hv->halfedge(), mesh))
+        std::vector<char> in_comp(mesh.size_of_facets(), 0);
+        for(auto hf : comp)
         {
-            if(hf != nullptr)
+            in_comp[hf->id()] = 1;
+        }
+        auto inside = [&](hHalfedge hh) { return !hh->is_border() && in_comp[hh->facet()->id()]; };
+        std::vector<hHalfedge> borders;
+        for(auto hf : comp)
+        {
+            for(auto hh : CGAL::halfedges_around_face(hf->halfedge(), mesh))
             {
-                label = std::max(label, hf->_label);
+                if(!inside(hh->opposite()))
+                {
+                    borders.push_back(hh->opposite());
+                }
             }
         }
-        hv->_label = label;
-    }
-
-    // Recompute label components
-    for(auto hf : CGAL::faces(mesh))
-    {
-        hf->_processed = false;
-    }
-    components.clear();
-    for (auto hf : CGAL::faces(mesh))
-    {
-        if (!hf->_processed && hf->_label != 0)
+        std::unordered_set<hHalfedge> visited;
+        for(auto start : borders)
         {
-            components.emplace_back(FacialConnectedComponents(hf, mesh, [](hFacet nei){ return nei->_label != 0; }));
+            if(visited.count(start))
+            {
+                continue;
+            }
+            std::vector<hHalfedge> cycle;
+            hHalfedge curr = start;
+            do
+            {
+                if(!visited.insert(curr).second)
+                {
+                    return false;
+                }
+                cycle.push_back(curr);
+                // rotate around the end vertex through faces of comp until leaving it
+                hHalfedge hh = curr->opposite()->prev();
+                size_t steps = 0;
+                while(inside(hh->opposite()))
+                {
+                    hh = hh->opposite()->prev();
+                    if(++steps > curr->vertex()->degree())
+                    {
+                        return false;
+                    }
+                }
+                curr = hh->opposite();
+            } while(curr != start);
+            cycles.push_back(std::move(cycle));
         }
+        return true;
     }
-    if (components.empty())
-    {
-        throw AlgError("Cannot find gum part");
-    }
-    printf("Divided ortho mesh into %zd submesh by label.\n", components.size());
 
-    using AABBPrimitive = CGAL::AABB_face_graph_triangle_primitive<Polyhedron>;
-    using AABBTraits = CGAL::AABB_traits<KernelEpick, AABBPrimitive>;
-    using AABBTree = CGAL::AABB_tree<AABBTraits>;
-    AABBTree aabb_tree(mesh.facets_begin(), mesh.facets_end(), mesh);
-    if (aabb_tree.empty())
+    // Border cycles of comp after copying it to part_mesh and repairing it, for face sets the tracer cannot handle.
+    std::vector<std::vector<hHalfedge>> RepairedBorderCycles(Polyhedron& mesh, const std::vector<hFacet>& comp, Polyhedron& part_mesh)
     {
-        throw AlgError("Failed to build AABB tree.");
-    }
-    std::vector<internal::Curve<Polyhedron::Traits>> trim_points;
-    for (auto &comp : components)
-    {
-        if(comp.size() < 100)
-        {
-            printf("Skip component with %zd faces.\n", comp.size());
-            continue;
-        }
-        printf("Processing component with %zd faces...\n", comp.size());
         CGAL::Face_filtered_graph<Polyhedron> filtered_graph(mesh, comp);
         if (!filtered_graph.is_selection_valid())
         {
             throw AlgError("Invalid part selection!");
         }
         /* Extract sub mesh */
-        Polyhedron part_mesh;
         std::vector<std::pair<hVertex, hVertex>> vtx_map;
         std::vector<std::pair<hFacet, hFacet>> facet_map;
         CGAL::copy_face_graph(filtered_graph, part_mesh,
@@ -491,7 +477,6 @@ bool GumTrimLine(std::string input_file, std::string label_file, std::string fra
         {
             throw AlgError("Cannot find trim line");
         }
-        part_mesh.UpdateFaceLabels2();
         printf("SubMesh valid. F = %zd\n", part_mesh.size_of_facets());
         // part_mesh.WriteOBJ("part_mesh" + std::to_string(part_mesh.size_of_vertices()) + ".obj");
         /* Extract borders */
@@ -499,6 +484,26 @@ bool GumTrimLine(std::string input_file, std::string label_file, std::string fra
         CGAL::Polygon_mesh_processing::extract_boundary_cycles(part_mesh, std::back_inserter(border_halfedges));
         std::vector<std::vector<hHalfedge>> border_cycles;
         std::transform(border_halfedges.begin(), border_halfedges.end(), std::back_inserter(border_cycles), [&part_mesh](auto& hf) { return GetBorderCycle(hf, part_mesh);});
+        return border_cycles;
+    }
+
+    // Trim line curves of one gum component. Only reads mesh, so components can be processed concurrently.
+    // Face ids must be set beforehand.
+    template <typename Projector>
+    std::vector<internal::Curve<Polyhedron::Traits>> ComponentCurves(Polyhedron& mesh, const std::vector<hFacet>& comp,
+        const Projector& projector, int smooth, const CrownFrames<Polyhedron::Traits>* crown_frames)
+    {
+        std::vector<internal::Curve<Polyhedron::Traits>> curves;
+        std::vector<std::vector<hHalfedge>> border_cycles;
+        Polyhedron part_mesh;
+        {
+            ORTHO_PROFILE_SCOPE("border_trace");
+            if(!TraceBorderCycles(mesh, comp, border_cycles))
+            {
+                printf("Cannot trace component border, repair it as a sub mesh.\n");
+                border_cycles = RepairedBorderCycles(mesh, comp, part_mesh);
+            }
+        }
         border_cycles.erase(std::remove_if(border_cycles.begin(), border_cycles.end(), [](std::vector<hHalfedge> &edges)
                                            { return edges.size() <= 10; }), border_cycles.end());
         if (border_cycles.empty())
@@ -514,23 +519,20 @@ bool GumTrimLine(std::string input_file, std::string label_file, std::string fra
             internal::Curve<Polyhedron::Traits> curve;
             for (auto hh : trimline)
             {
-                curve.AddPoint(hh->vertex()->point(), hh->opposite()->facet()->_label);
+                auto inner = hh->opposite();
+                curve.AddPoint(hh->vertex()->point(), Polyhedron::FaceLabelFromVertices(inner->vertex()->_label,
+                    inner->next()->vertex()->_label, inner->prev()->vertex()->_label));
             }
 
-            for (size_t iteration = 0; iteration < smooth; iteration++)
             {
-                std::vector<Point_3> new_points = curve.GetPoints();
-                for (size_t i = 0; i < new_points.size(); i++)
+                ORTHO_PROFILE_SCOPE("smooth");
+                TClosedPolyline<> polyline(curve.begin(), curve.end());
+                for (size_t iteration = 0; iteration < smooth; iteration++)
                 {
-                    size_t prev = i == 0 ? new_points.size() - 1 : i - 1;
-                    size_t next = i == new_points.size() - 1 ? 0 : i + 1;
-                    new_points[i] = new_points[i] + 0.5 * (CGAL::midpoint(curve[prev], curve[next]) - curve[i]);
-                    new_points[i] = aabb_tree.closest_point(new_points[i]);
-                }
-                for(size_t i = 0; i < curve.size(); i++)
-                {
-                    curve[i] = new_points[i];
+                    polyline.Laplacian(0.5);
+                    curve.ProjectCoherent(projector, polyline);
                 }
+                polyline.CopyTo(curve.begin());
             }
             curve.UpdateData();
             if(crown_frames != nullptr)
@@ -538,96 +540,936 @@ bool GumTrimLine(std::string input_file, std::string label_file, std::string fra
                 curve.LoadCrownFrame(*crown_frames);
             }
             //curve.WriteOBJ("curve" + std::to_string(curve.size()) + ".obj");
-            trim_points.push_back(curve);
+            curves.push_back(curve);
             printf("Added curve of %zd points.\n", curve.size());
         }
+        return curves;
     }
 
-    std::sort(trim_points.begin(), trim_points.end(), [](auto& lh, auto& rh){
-            int maxl = lh.MaxLabel();
-            int minl = lh.MinLabel();
-            int maxr = rh.MaxLabel();
-            int minr = rh.MinLabel();
-
-            if(maxl <= 18 && maxl >= 11)
-                maxl = 29 - maxl;
-            else if(maxl >= 31 && maxl <= 38)
-                maxl = 69 - maxl;
-            if(minl <= 18 && minl >= 11)
-                minl = 29 - minl;
-            else if(minl >= 31 && minl <= 38)
-                minl = 69 - minl;
-            
-            if(maxr <= 18 && maxr >= 11)
-                maxr = 29 - maxr;
-            else if(maxr >= 31 && maxr <= 38)
-                maxr = 69 - maxr;
-            if(minr <= 18 && minr >= 11)
-                minr = 29 - minr;
-            else if(minr >= 31 && minr <= 38)
-                minr = 69 - minr;
+    // Trim line curves of the previous run on the same mesh, stored in the MeshCache under kind "trimline".
+    // Component curves are keyed by the labels of their faces and merged curves by the keys of both halves,
+    // so after a few teeth are relabeled only their components and the merges above them miss. Only the
+    // curves used by the current run are stored back. Does nothing if the MeshCache is disabled.
+    // With a proxy the entry is keyed by the full resolution mesh and the proxy ratio, since the decimated copy
+    // changes with the labels.
+    class TrimLineCache
+    {
+    public:
+        using Curve = internal::Curve<Polyhedron::Traits>;
+
+        explicit TrimLineCache(const Polyhedron& mesh, double proxy_ratio = 0.0)
+            : _cache(MeshCache::Default())
+        {
+            if(_cache == nullptr)
+            {
+                return;
+            }
+            _mesh_key = MeshHash(mesh);
+            if(proxy_ratio > 0.0)
+            {
+                internal::Fnv1a64 hash;
+                hash.Add(_mesh_key);
+                hash.Add(proxy_ratio);
+                _mesh_key = hash.Value();
+            }
+            if(auto entry = _cache->Load(_mesh_key, "trimline"))
+            {
+                Parse(entry->_sections);
+            }
+        }
+
+        // Curves stored under key, with UpdateData called. Thread safe.
+        std::optional<std::vector<Curve>> Find(uint64_t key)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            auto it = _old.find(key);
+            if(it == _old.end())
+            {
+                _nb_misses++;
+                return std::nullopt;
+            }
+            _nb_hits++;
+            const Record& record = _new.insert(*it).first->second;
+            std::vector<Curve> curves(record._sizes.size());
+            size_t offset = 0;
+            for(size_t c = 0; c < curves.size(); c++)
+            {
+                for(size_t i = 0; i < record._sizes[c]; i++, offset++)
+                {
+                    curves[c].AddPoint(Point_3(record._coords[3 * offset], record._coords[3 * offset + 1], record._coords[3 * offset + 2]),
+                        record._labels[offset]);
+                }
+                curves[c].UpdateData();
+            }
+            return curves;
+        }
+
+        // Thread safe.
+        void Insert(uint64_t key, const std::vector<Curve>& curves)
+        {
+            if(_cache == nullptr)
+            {
+                return;
+            }
+            Record record;
+            for(const auto& curve : curves)
+            {
+                record._sizes.push_back(curve.size());
+                for(size_t i = 0; i < curve.size(); i++)
+                {
+                    record._coords.insert(record._coords.end(), { curve[i].x(), curve[i].y(), curve[i].z() });
+                    record._labels.push_back(curve.Label(i));
+                }
+            }
+            std::lock_guard<std::mutex> lock(_mutex);
+            _new[key] = std::move(record);
+        }
+
+        void Save()
+        {
+            if(_cache == nullptr)
+            {
+                return;
+            }
+            printf("Reused %zd of %zd cached trim line curves.\n", _nb_hits, _nb_hits + _nb_misses);
+            // keys, curves per key, points per curve, coordinates, labels
+            std::vector<uint64_t> keys;
+            std::vector<uint64_t> nb_curves;
+            std::vector<uint64_t> sizes;
+            std::vector<double> coords;
+            std::vector<int32_t> labels;
+            for(const auto& [key, record] : _new)
+            {
+                keys.push_back(key);
+                nb_curves.push_back(record._sizes.size());
+                sizes.insert(sizes.end(), record._sizes.begin(), record._sizes.end());
+                coords.insert(coords.end(), record._coords.begin(), record._coords.end());
+                labels.insert(labels.end(), record._labels.begin(), record._labels.end());
+            }
+            _cache->Store(_mesh_key, "trimline", { std::as_bytes(std::span<const uint64_t>(keys)),
+                std::as_bytes(std::span<const uint64_t>(nb_curves)), std::as_bytes(std::span<const uint64_t>(sizes)),
+                std::as_bytes(std::span<const double>(coords)), std::as_bytes(std::span<const int32_t>(labels)) });
+        }
 
-            if(minl != minr)
+    protected:
+        struct Record
+        {
+            std::vector<uint64_t> _sizes;
+            std::vector<double> _coords;
+            std::vector<int32_t> _labels;
+        };
+
+        template <typename T>
+        static std::vector<T> Array(std::span<const std::byte> section)
+        {
+            std::vector<T> values(section.size() / sizeof(T));
+            std::memcpy(values.data(), section.data(), values.size() * sizeof(T));
+            return values;
+        }
+
+        // Entries that do not add up are ignored as a whole.
+        void Parse(const std::vector<std::span<const std::byte>>& sections)
+        {
+            if(sections.size() != 5)
+            {
+                return;
+            }
+            auto keys = Array<uint64_t>(sections[0]);
+            auto nb_curves = Array<uint64_t>(sections[1]);
+            auto sizes = Array<uint64_t>(sections[2]);
+            auto coords = Array<double>(sections[3]);
+            auto labels = Array<int32_t>(sections[4]);
+            size_t total_curves = 0;
+            for(auto n : nb_curves)
+                total_curves += n;
+            size_t total_points = 0;
+            for(auto n : sizes)
+                total_points += n;
+            if(nb_curves.size() != keys.size() || total_curves != sizes.size() || labels.size() != total_points || coords.size() != 3 * total_points)
             {
-                return minl < minr;
+                return;
             }
-            return maxl < maxr;
-    });
+            size_t curve = 0;
+            size_t point = 0;
+            for(size_t k = 0; k < keys.size(); k++)
+            {
+                Record& record = _old[keys[k]];
+                for(size_t c = 0; c < nb_curves[k]; c++, curve++)
+                {
+                    record._sizes.push_back(sizes[curve]);
+                    record._coords.insert(record._coords.end(), coords.begin() + 3 * point, coords.begin() + 3 * (point + sizes[curve]));
+                    record._labels.insert(record._labels.end(), labels.begin() + point, labels.begin() + point + sizes[curve]);
+                    point += sizes[curve];
+                }
+            }
+        }
+
+        MeshCache* _cache;
+        uint64_t _mesh_key = 0;
+        std::unordered_map<uint64_t, Record> _old;
+        std::unordered_map<uint64_t, Record> _new;
+        std::mutex _mutex;
+        size_t _nb_hits = 0;
+        size_t _nb_misses = 0;
+    };
+
+    // Key of a component for TrimLineCache: its faces with their labels and the labels of their vertices, and
+    // the key of the parameters.
+    uint64_t ComponentKey(const std::vector<hFacet>& comp, uint64_t params)
+    {
+        internal::Fnv1a64 hash;
+        hash.Add(params);
+        for(auto hf : comp)
+        {
+            hash.Add(static_cast<uint64_t>(hf->id()));
+            hash.Add(hf->_label);
+            auto hh = hf->halfedge();
+            do
+            {
+                hash.Add(hh->vertex()->_label);
+                hh = hh->next();
+            } while(hh != hf->halfedge());
+        }
+        return hash.Value();
+    }
+
+    // Key of the crown frame file content, 0 without frames.
+    uint64_t FrameKey(const std::string& frame_file)
+    {
+        if(frame_file.empty())
+        {
+            return 0;
+        }
+        std::ifstream ifs(frame_file, std::ios::binary);
+        std::string content((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+        internal::Fnv1a64 hash;
+        hash.Add(content.data(), content.size());
+        return hash.Value();
+    }
+
+    template <typename... T>
+    uint64_t HashOf(const T&... values)
+    {
+        internal::Fnv1a64 hash;
+        (hash.Add(values), ...);
+        return hash.Value();
+    }
 
-    auto& final_curve = trim_points[0];
-    if (trim_points.size() >= 2)
+    // The trim line of a loaded mesh; input_name only appears in error messages.
+    // With roi_width > 0 the projection tree only holds the faces within that distance of the label borders.
+    // When mesh is a proxy, full_mesh is the mesh it was decimated from, with ids set, and keys the TrimLineCache.
+    internal::Curve<Polyhedron::Traits> TrimLineCurve(Polyhedron& mesh, const std::string& input_name, const std::string& frame_file,
+        int smooth, double fix_factor, double roi_width, bool roi_geodesic, const Polyhedron* full_mesh = nullptr, double proxy_ratio = 0.0)
     {
-        for(int i = 1; i < trim_points.size(); i++)
+        ORTHO_PROFILE_SCOPE("trim_line");
+        if (!mesh.is_valid(false))
         {
-            trim_points[0] = Merge(trim_points[0], trim_points[i], aabb_tree);
+            mesh.is_valid(true);
+            throw MeshError("Input mesh not valid: " + input_name);
+        }
+        if (!mesh.is_pure_triangle())
+        {
+            throw MeshError("Input mesh has non triangle face: " + input_name);
+        }
+
+        for(auto hv : CGAL::vertices(mesh))
+        {
+            if(hv->_label == 1)
+                hv->_label = 0;
+        }
+        std::unique_ptr<CrownFrames<typename Polyhedron::Traits>> crown_frames = nullptr;
+        if(!frame_file.empty())
+        {
+            crown_frames = std::make_unique<CrownFrames<typename Polyhedron::Traits>>(frame_file);
+        }
+        CGAL::set_halfedgeds_items_id(mesh);
+        printf("Load ortho scan mesh: V = %zd, F = %zd.\n", mesh.size_of_vertices(), mesh.size_of_facets());
+    
+        {
+            ORTHO_PROFILE_SCOPE("label_processing");
+            LabelProcessing(mesh);
+            mesh.UpdateFaceLabels2();
+        }
+        // mesh.WriteTriSoup("processed_mesh" + std::to_string(mesh.size_of_facets()) + ".obj");
+
+        using SubMesh = std::vector<hFacet>;
+        const std::vector<hFacet> all_faces(mesh.facets_begin(), mesh.facets_end());
+        std::vector<SubMesh> components = FaceComponents(mesh, [](hFacet f0, hFacet f1) { return (f0->_label != 0) == (f1->_label != 0); }).Group(all_faces);
+        if (components.empty())
+        {
+            throw AlgError("Cannot find gum part");
+        }
+
+        // clean components
+        {
+            ORTHO_PROFILE_SCOPE("clean_components");
+            std::vector<std::unordered_map<int, int>> comp_label_counts;
+            std::unordered_map<int, int> max_label_size;
+            std::array<bool, 50> label_exist;
+            std::fill(label_exist.begin(), label_exist.end(), false);
+            for(auto& comp : components)
+            {
+                comp_label_counts.emplace_back();
+                for(auto hf : comp)
+                {
+                    comp_label_counts.back()[hf->_label]++;
+                    label_exist[hf->_label] = true;
+                }
+            }
+            for(auto& counts : comp_label_counts)
+            {
+                for(auto& pair : counts)
+                {
+                    max_label_size[pair.first] = std::max(max_label_size[pair.first], pair.second);
+                }
+            }
+            for(int i = 0; i < components.size(); i++)
+            {
+                std::unordered_set<int> label_to_remove;
+                for(auto& [label, cnt] : comp_label_counts[i])
+                {
+                    if(cnt != max_label_size[label])
+                    {
+                        label_to_remove.insert(label);
+                    }
+                }
+                std::vector<hFacet> face_to_relabel;
+                for(auto hf : components[i])
+                {
+                    if(label_to_remove.count(hf->_label))
+                    {
+                        face_to_relabel.push_back(hf);
+                    }
+                }
+                if(face_to_relabel.empty())
+                {
+                    continue;
+                }
+                TransferFaceLabelsFromSurroundings(mesh, face_to_relabel, [&](hFacet hf, hFacet nei) { return label_to_remove.count(nei->_label) == 0; });
+            }
+
+            // map face labels to vertex labels
+            for(auto hv : CGAL::vertices(mesh))
+            {
+                int label = 0;
+                for(auto hf : CGAL::faces_around_target(hv->halfedge(), mesh))
+                {
+                    if(hf != nullptr)
+                    {
+                        label = std::max(label, hf->_label);
+                    }
+                }
+                hv->_label = label;
+            }
+        }
+
+        // Recompute label components
+        components = FaceComponents(mesh, [](hFacet f0, hFacet f1) { return f0->_label != 0 && f1->_label != 0; })
+                         .Group(all_faces, [](hFacet f) { return f->_label != 0; });
+        if (components.empty())
+        {
+            throw AlgError("Cannot find gum part");
+        }
+        printf("Divided ortho mesh into %zd submesh by label.\n", components.size());
+
+        // The curves only move near the borders of the components, so the projections never need faces
+        // far from them.
+        std::vector<hFacet> roi_faces;
+        if(roi_width > 0.0)
+        {
+            ORTHO_PROFILE_SCOPE("roi");
+            roi_faces = LabelBorderBand(mesh, roi_width, roi_geodesic);
+            printf("Region of interest: %zd of %zd faces.\n", roi_faces.size(), mesh.size_of_facets());
+        }
+#ifdef ORTHO_FLAT_BVH
+        using AABBTree = FlatBVH<Polyhedron>;
+        AABBTree aabb_tree = roi_width > 0.0 ? AABBTree(roi_faces.begin(), roi_faces.end(), mesh) : CachedFlatBVH(mesh);
+#else
+        using AABBPrimitive = CGAL::AABB_face_graph_triangle_primitive<Polyhedron>;
+        using AABBTraits = CGAL::AABB_traits<KernelEpick, AABBPrimitive>;
+        using AABBTree = CGAL::AABB_tree<AABBTraits>;
+        AABBTree aabb_tree = roi_width > 0.0 ? AABBTree(roi_faces.begin(), roi_faces.end(), mesh)
+                                             : AABBTree(mesh.facets_begin(), mesh.facets_end(), mesh);
+#endif
+        if (aabb_tree.empty())
+        {
+            throw AlgError("Failed to build AABB tree.");
+        }
+        PrepareForProjection(aabb_tree);
+        const TFaceHintProjector<Polyhedron, AABBTree> projector(mesh, aabb_tree);
+        TrimLineCache cache(full_mesh != nullptr ? *full_mesh : mesh, full_mesh != nullptr ? proxy_ratio : 0.0);
+        const uint64_t frame_key = FrameKey(frame_file);
+        const uint64_t params_key = HashOf(smooth, roi_width > 0.0 ? roi_width : 0.0, roi_width > 0.0 && roi_geodesic);
+        // Components are independent apart from the read-only mesh and tree. Each writes its own slot, and
+        // the curves are gathered in component order so the result does not depend on scheduling.
+        std::vector<std::vector<internal::Curve<Polyhedron::Traits>>> comp_curves(components.size());
+        std::vector<std::exception_ptr> comp_errors(components.size());
+        std::vector<uint64_t> comp_keys(components.size());
+        {
+            ORTHO_PROFILE_SCOPE("component_curves");
+#pragma omp parallel for schedule(dynamic)
+            for (int i = 0; i < components.size(); i++)
+            {
+                if(components[i].size() < 100)
+                {
+                    printf("Skip component with %zd faces.\n", components[i].size());
+                    continue;
+                }
+                comp_keys[i] = ComponentKey(components[i], params_key);
+                if(auto cached = cache.Find(comp_keys[i]))
+                {
+                    comp_curves[i] = std::move(*cached);
+                    if(crown_frames != nullptr)
+                    {
+                        for(auto& curve : comp_curves[i])
+                            curve.LoadCrownFrame(*crown_frames);
+                    }
+                    continue;
+                }
+                printf("Processing component with %zd faces...\n", components[i].size());
+                try
+                {
+                    comp_curves[i] = ComponentCurves(mesh, components[i], projector, smooth, crown_frames.get());
+                    cache.Insert(comp_keys[i], comp_curves[i]);
+                }
+                catch(...)
+                {
+                    comp_errors[i] = std::current_exception();
+                }
+            }
+        }
+        // trim_keys[i] is the cache key of trim_points[i]
+        std::vector<internal::Curve<Polyhedron::Traits>> trim_points;
+        std::vector<uint64_t> trim_keys;
+        for (size_t i = 0; i < components.size(); i++)
+        {
+            if(comp_errors[i])
+            {
+                std::rethrow_exception(comp_errors[i]);
+            }
+            for(size_t j = 0; j < comp_curves[i].size(); j++)
+            {
+                trim_points.push_back(std::move(comp_curves[i][j]));
+                trim_keys.push_back(HashOf(comp_keys[i], j));
+            }
+        }
+        if (trim_points.empty())
+        {
+            throw AlgError("No valid trim line.");
+        }
+
+        std::vector<size_t> order(trim_points.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&](size_t i, size_t j){
+                const auto& lh = trim_points[i];
+                const auto& rh = trim_points[j];
+                int maxl = lh.MaxLabel();
+                int minl = lh.MinLabel();
+                int maxr = rh.MaxLabel();
+                int minr = rh.MinLabel();
+
+                if(maxl <= 18 && maxl >= 11)
+                    maxl = 29 - maxl;
+                else if(maxl >= 31 && maxl <= 38)
+                    maxl = 69 - maxl;
+                if(minl <= 18 && minl >= 11)
+                    minl = 29 - minl;
+                else if(minl >= 31 && minl <= 38)
+                    minl = 69 - minl;
+            
+                if(maxr <= 18 && maxr >= 11)
+                    maxr = 29 - maxr;
+                else if(maxr >= 31 && maxr <= 38)
+                    maxr = 69 - maxr;
+                if(minr <= 18 && minr >= 11)
+                    minr = 29 - minr;
+                else if(minr >= 31 && minr <= 38)
+                    minr = 69 - minr;
+
+                if(minl != minr)
+                {
+                    return minl < minr;
+                }
+                return maxl < maxr;
+        });
+        {
+            std::vector<internal::Curve<Polyhedron::Traits>> sorted_points;
+            std::vector<uint64_t> sorted_keys;
+            for(size_t i : order)
+            {
+                sorted_points.push_back(std::move(trim_points[i]));
+                sorted_keys.push_back(trim_keys[i]);
+            }
+            trim_points = std::move(sorted_points);
+            trim_keys = std::move(sorted_keys);
+        }
+
+        // Merge adjacent curves level by level. Pairs on one level are independent, and keeping them adjacent
+        // preserves the order above, so each merge still joins neighboring teeth.
+        const bool merged = trim_points.size() >= 2;
+        {
+            ORTHO_PROFILE_SCOPE("merge");
+            while (trim_points.size() > 1)
+            {
+                std::vector<internal::Curve<Polyhedron::Traits>> next((trim_points.size() + 1) / 2);
+                std::vector<uint64_t> next_keys(next.size());
+                std::vector<std::exception_ptr> merge_errors(next.size());
+#pragma omp parallel for schedule(dynamic)
+                for (int i = 0; i < next.size(); i++)
+                {
+                    if (2 * i + 1 == trim_points.size())
+                    {
+                        next[i] = std::move(trim_points[2 * i]);
+                        next_keys[i] = trim_keys[2 * i];
+                        continue;
+                    }
+                    next_keys[i] = HashOf(trim_keys[2 * i], trim_keys[2 * i + 1], frame_key);
+                    try
+                    {
+                        if(auto cached = cache.Find(next_keys[i]))
+                        {
+                            next[i] = std::move(cached->front());
+                        }
+                        else
+                        {
+                            next[i] = Merge(std::move(trim_points[2 * i]), trim_points[2 * i + 1], aabb_tree);
+                            cache.Insert(next_keys[i], { next[i] });
+                        }
+                        if(crown_frames != nullptr)
+                        {
+                            next[i].LoadCrownFrame(*crown_frames);
+                        }
+                    }
+                    catch(...)
+                    {
+                        merge_errors[i] = std::current_exception();
+                    }
+                }
+                for (auto& e : merge_errors)
+                {
+                    if(e)
+                    {
+                        std::rethrow_exception(e);
+                    }
+                }
+                trim_points = std::move(next);
+                trim_keys = std::move(next_keys);
+            }
+        }
+
+        auto& final_curve = trim_points[0];
+        const uint64_t final_key = HashOf(trim_keys[0], frame_key, fix_factor, merged);
+        if(auto cached = cache.Find(final_key))
+        {
+            final_curve = std::move(cached->front());
+        }
+        else
+        {
+            if (merged)
+            {
+                std::vector<Point_3> projected = final_curve.GetPoints();
+                BatchClosestPoints(aabb_tree, projected);
+                for(size_t i = 0; i < final_curve.size(); i++)
+                {
+                    final_curve[i] = projected[i];
+                }
+            }
+            final_curve.UpdateData();
             if(crown_frames != nullptr)
             {
-                trim_points[0].LoadCrownFrame(*crown_frames);
+                final_curve.LoadCrownFrame(*crown_frames);
+            }
+            if(fix_factor != 0.0)
+            {
+                ORTHO_PROFILE_SCOPE("fix_shape");
+                final_curve.FixAllCurve(aabb_tree, fix_factor);
+            }
+            {
+                ORTHO_PROFILE_SCOPE("final_smooth");
+                TClosedPolyline<> polyline(final_curve.begin(), final_curve.end());
+                polyline.Laplacian(1.0);
+                std::vector<Point_3> new_points(final_curve.size());
+                polyline.CopyTo(new_points.begin());
+                BatchClosestPoints(aabb_tree, std::span<const Point_3>(new_points), std::span<Point_3>(final_curve.begin(), final_curve.end()));
+                polyline.Assign(final_curve.begin(), final_curve.end());
+                polyline.Laplacian(0.5);
+                polyline.CopyTo(final_curve.begin());
             }
+            cache.Insert(final_key, { final_curve });
         }
-        for(size_t i = 0; i < final_curve.size(); i++)
+        cache.Save();
+
+        ORTHO_PROFILE_COUNTER("trim_line_points", final_curve.size());
+        return std::move(final_curve);
+    }
+
+    // Edges between vertices of different labels, which the proxy decimation keeps. Label 1 counts as gum.
+    struct LabelBorderEdgeMap
+    {
+        using key_type = boost::graph_traits<Polyhedron>::edge_descriptor;
+        using value_type = bool;
+        using reference = bool;
+        using category = boost::readable_property_map_tag;
+
+        friend bool get(const LabelBorderEdgeMap&, key_type e)
         {
-            final_curve[i] = aabb_tree.closest_point(final_curve[i]);
+            auto gum = [](int label) { return label == 1 ? 0 : label; };
+            return gum(e.halfedge()->vertex()->_label) != gum(e.halfedge()->opposite()->vertex()->_label);
         }
+    };
+
+    // Collapse edges until about ratio of them is left. Label border edges are not collapsed and their vertices
+    // do not move, so the components keep their borders.
+    void DecimateKeepingLabels(Polyhedron& mesh, double ratio)
+    {
+        namespace SMS = CGAL::Surface_mesh_simplification;
+        ORTHO_PROFILE_SCOPE("decimate");
+        CGAL::set_halfedgeds_items_id(mesh);
+        LabelBorderEdgeMap constraints;
+        SMS::Edge_count_ratio_stop_predicate<Polyhedron> stop(ratio);
+        SMS::Constrained_placement<SMS::LindstromTurk_placement<Polyhedron>, LabelBorderEdgeMap> placement(constraints);
+        int nb_removed = SMS::edge_collapse(mesh, stop, CGAL::parameters::edge_is_constrained_map(constraints)
+            .get_cost(SMS::LindstromTurk_cost<Polyhedron>()).get_placement(placement));
+        CGAL::set_halfedgeds_items_id(mesh);
+        printf("Decimated proxy: removed %d edges, V = %zd, F = %zd.\n", nb_removed, mesh.size_of_vertices(), mesh.size_of_facets());
     }
-    final_curve.UpdateData();
-    if(crown_frames != nullptr)
+
+    double MeanEdgeLength(const Polyhedron& mesh)
     {
-        final_curve.LoadCrownFrame(*crown_frames);
+        double sum = 0.0;
+        for(auto he = mesh.edges_begin(); he != mesh.edges_end(); he++)
+        {
+            sum += std::sqrt(CGAL::squared_distance(he->vertex()->point(), he->opposite()->vertex()->point()));
+        }
+        return mesh.size_of_halfedges() == 0 ? 0.0 : sum / (mesh.size_of_halfedges() / 2);
     }
-    if(fix_factor != 0.0)
+
+    // Edges between a gum face among faces and a tooth face, as segments. Face labels follow
+    // FaceLabelFromVertices with label 1 counted as gum, as in TrimLineCurve.
+    std::vector<Polyhedron::Traits::Segment_3> GumBorderSegments(const std::vector<hFacet>& faces)
     {
-        final_curve.FixAllCurve(aabb_tree, fix_factor);
+        auto is_gum = [](hFacet hf) {
+            auto label = [](hVertex hv) { return hv->_label == 1 ? 0 : hv->_label; };
+            auto hh = hf->halfedge();
+            return Polyhedron::FaceLabelFromVertices(label(hh->vertex()), label(hh->next()->vertex()), label(hh->prev()->vertex())) == 0;
+        };
+        std::vector<Polyhedron::Traits::Segment_3> segments;
+        for(auto hf : faces)
+        {
+            if(!is_gum(hf))
+                continue;
+            auto hh = hf->halfedge();
+            do
+            {
+                if(!hh->opposite()->is_border() && !is_gum(hh->opposite()->facet()))
+                {
+                    segments.emplace_back(hh->prev()->vertex()->point(), hh->vertex()->point());
+                }
+                hh = hh->next();
+            } while(hh != hf->halfedge());
+        }
+        return segments;
     }
-    for (size_t iteration = 0; iteration < 1; iteration++)
+
+    // Closest points to a set of segments within a search radius.
+    class SegmentGrid
+    {
+    public:
+        SegmentGrid(const std::vector<Polyhedron::Traits::Segment_3>& segments, double radius)
+            : _segments(segments), _radius(radius), _midpoints(Midpoints(segments)),
+            _grid(_midpoints, radius + MaxHalfLength(segments))
+        {
+        }
+
+        // Closest point to p on the segments if one is closer than the radius.
+        std::optional<Point_3> Closest(const Point_3& p) const
+        {
+            std::optional<Point_3> best;
+            double best_d = _radius * _radius;
+            _grid.ForEachInRadius(p, [&](size_t i, double) {
+                const auto& seg = _segments[i];
+                auto v = seg.target() - seg.source();
+                double len2 = v.squared_length();
+                double t = len2 > 0.0 ? std::clamp(((p - seg.source()) * v) / len2, 0.0, 1.0) : 0.0;
+                Point_3 q = seg.source() + t * v;
+                double d = CGAL::squared_distance(p, q);
+                if(d < best_d)
+                {
+                    best_d = d;
+                    best = q;
+                }
+            });
+            return best;
+        }
+
+    protected:
+        static std::vector<Point_3> Midpoints(const std::vector<Polyhedron::Traits::Segment_3>& segments)
+        {
+            std::vector<Point_3> midpoints;
+            for(const auto& seg : segments)
+            {
+                midpoints.push_back(CGAL::midpoint(seg.source(), seg.target()));
+            }
+            return midpoints;
+        }
+
+        static double MaxHalfLength(const std::vector<Polyhedron::Traits::Segment_3>& segments)
+        {
+            double len = 0.0;
+            for(const auto& seg : segments)
+            {
+                len = std::max(len, std::sqrt(seg.squared_length()) / 2.0);
+            }
+            return len;
+        }
+
+        const std::vector<Polyhedron::Traits::Segment_3>& _segments;
+        double _radius;
+        std::vector<Point_3> _midpoints;
+        PointGrid _grid;
+    };
+
+    // Move a trim line found on a decimated copy onto mesh. The line is projected onto the faces of mesh within
+    // radius of it, then each point is snapped to the closest gum border edge of mesh within radius, and the
+    // line gets one smoothing step projected back onto those faces, as the final smoothing of TrimLineCurve.
+    // Points with no border edge in reach keep their projection. Returns the largest distance from a point of
+    // the result to the gum borders of mesh, radius for points with no border edge in reach.
+    double RetraceOnMesh(internal::Curve<Polyhedron::Traits>& curve, Polyhedron& mesh, double radius)
     {
-        std::vector<Point_3> new_points = final_curve.GetPoints();
-        for (size_t i = 0; i < new_points.size(); i++)
+        ORTHO_PROFILE_SCOPE("retrace");
+        const std::vector<Point_3> proxy_points = curve.GetPoints();
+        const std::vector<hVertex> vertices(mesh.vertices_begin(), mesh.vertices_end());
+        PointGrid grid(proxy_points, radius);
+        std::vector<char> near_line(vertices.size(), 0);
+#pragma omp parallel for schedule(dynamic, 1024)
+        for(int i = 0; i < vertices.size(); i++)
+        {
+            grid.ForEachInRadius(vertices[i]->point(), [&](size_t, double) { near_line[i] = 1; });
+        }
+        CGAL::set_halfedgeds_items_id(mesh);
+        std::vector<hFacet> faces;
+        for(auto hf = mesh.facets_begin(); hf != mesh.facets_end(); hf++)
+        {
+            for(auto hv : CGAL::vertices_around_face(hf->halfedge(), mesh))
+            {
+                if(near_line[hv->id()])
+                {
+                    faces.push_back(hf);
+                    break;
+                }
+            }
+        }
+        if(faces.empty())
+        {
+            throw AlgError("Proxy trim line is too far from the mesh.");
+        }
+#ifdef ORTHO_FLAT_BVH
+        using AABBTree = FlatBVH<Polyhedron>;
+#else
+        using AABBPrimitive = CGAL::AABB_face_graph_triangle_primitive<Polyhedron>;
+        using AABBTraits = CGAL::AABB_traits<KernelEpick, AABBPrimitive>;
+        using AABBTree = CGAL::AABB_tree<AABBTraits>;
+#endif
+        AABBTree aabb_tree(faces.begin(), faces.end(), mesh);
+        PrepareForProjection(aabb_tree);
+        std::vector<Point_3> points = proxy_points;
+        BatchClosestPoints(aabb_tree, points);
+
+        const auto segments = GumBorderSegments(faces);
+        if(segments.empty())
+        {
+            printf("No gum border of the mesh near the proxy trim line, keeping its projection.\n");
+            for(size_t i = 0; i < curve.size(); i++)
+            {
+                curve[i] = points[i];
+            }
+            return radius;
+        }
+        const SegmentGrid borders(segments, radius);
+        int nb_snapped = 0;
+#pragma omp parallel for reduction(+:nb_snapped)
+        for(int i = 0; i < points.size(); i++)
+        {
+            if(auto q = borders.Closest(points[i]))
+            {
+                points[i] = *q;
+                nb_snapped++;
+            }
+        }
+        TClosedPolyline<> polyline(points.begin(), points.end());
+        polyline.Laplacian(0.5);
+        polyline.CopyTo(points.begin());
+        BatchClosestPoints(aabb_tree, points);
+
+        std::vector<double> distances(points.size(), radius);
+#pragma omp parallel for
+        for(int i = 0; i < points.size(); i++)
         {
-            size_t prev = i == 0 ? new_points.size() - 1 : i - 1;
-            size_t next = i == new_points.size() - 1 ? 0 : i + 1;
-            new_points[i] = CGAL::midpoint(final_curve[prev], final_curve[next]);
-            new_points[i] = aabb_tree.closest_point(new_points[i]);
+            if(auto q = borders.Closest(points[i]))
+            {
+                distances[i] = std::sqrt(CGAL::squared_distance(points[i], *q));
+            }
         }
-        for(size_t i = 0; i < final_curve.size(); i++)
+        for(size_t i = 0; i < curve.size(); i++)
         {
-            final_curve[i] = new_points[i];
+            curve[i] = points[i];
         }
+        printf("Snapped %d of %zd proxy trim line points to the gum borders of the mesh.\n", nb_snapped, points.size());
+        return distances.empty() ? 0.0 : *std::max_element(distances.begin(), distances.end());
     }
-    for (size_t iteration = 0; iteration < 1; iteration++)
+
+    // TrimLineCurve of the job. With 0 < proxy_ratio < 1 the curve is found on a decimated copy of mesh and
+    // then re-traced on mesh with RetraceOnMesh, and deviation is set to the largest distance from the result to
+    // the gum borders of mesh; otherwise it is 0.
+    internal::Curve<Polyhedron::Traits> JobCurve(Polyhedron& mesh, const std::string& input_name, const GumTrimLineJob& job,
+        double& deviation)
     {
-        std::vector<Point_3> new_points = final_curve.GetPoints();
-        for (size_t i = 0; i < new_points.size(); i++)
+        deviation = 0.0;
+        if(job.proxy_ratio <= 0.0 || job.proxy_ratio >= 1.0)
+        {
+            return TrimLineCurve(mesh, input_name, job.frame_file, job.smooth, job.fix_factor, job.roi_width, job.roi_geodesic);
+        }
+        Polyhedron proxy = mesh;
+        DecimateKeepingLabels(proxy, job.proxy_ratio);
+        CGAL::set_halfedgeds_items_id(mesh);
+        auto curve = TrimLineCurve(proxy, input_name, job.frame_file, job.smooth, job.fix_factor, job.roi_width, job.roi_geodesic,
+            &mesh, job.proxy_ratio);
+        // the proxy faces stay within about an edge length of the mesh.
+        deviation = RetraceOnMesh(curve, mesh, 2.0 * MeanEdgeLength(proxy));
+        printf("Proxy trim line deviation from the gum borders: %f.\n", deviation);
+        return curve;
+    }
+
+    void LoadJobMesh(const GumTrimLineJob& job, Polyhedron& mesh)
+    {
+        ORTHO_PROFILE_SCOPE("load");
+        if(job.vertices.empty())
+        {
+            try
+            {
+                LoadMeshWithLabel(job.input_file, LoadLabels(job.label_file), mesh);
+            }
+            catch(const std::exception&)
+            {
+                throw IOError("Cannot read mesh file or mesh invalid: " + job.input_file);
+            }
+            return;
+        }
+        const size_t nb_vertices = job.vertices.size() / 3;
+        if(job.vertices.size() % 3 != 0 || job.faces.size() % 3 != 0 || job.labels.size() != nb_vertices)
+        {
+            throw IOError("Mesh arrays need 3 coordinates per vertex, 3 indices per face and 1 label per vertex.");
+        }
+        std::vector<Point_3> vertices;
+        vertices.reserve(nb_vertices);
+        for(size_t i = 0; i < nb_vertices; i++)
+        {
+            vertices.emplace_back(job.vertices[i * 3], job.vertices[i * 3 + 1], job.vertices[i * 3 + 2]);
+        }
+        using Triangle = TTriangle<Polyhedron::Vertex::size_type>;
+        std::vector<Triangle> faces;
+        faces.reserve(job.faces.size() / 3);
+        for(size_t i = 0; i < job.faces.size(); i += 3)
+        {
+            for(int k = 0; k < 3; k++)
+            {
+                if(job.faces[i + k] < 0 || job.faces[i + k] >= nb_vertices)
+                {
+                    throw IOError("Face index out of range: " + std::to_string(job.faces[i + k]));
+                }
+            }
+            faces.emplace_back(job.faces[i], job.faces[i + 1], job.faces[i + 2]);
+        }
+        try
+        {
+            LoadMeshWithLabel(vertices, std::move(faces), job.labels, mesh);
+        }
+        catch(const std::exception&)
         {
-            size_t prev = i == 0 ? new_points.size() - 1 : i - 1;
-            size_t next = i == new_points.size() - 1 ? 0 : i + 1;
-            new_points[i] = new_points[i] + 0.5 * (CGAL::midpoint(final_curve[prev], final_curve[next]) - final_curve[i]);
+            throw IOError("Cannot build mesh from arrays or mesh invalid.");
         }
-        for(size_t i = 0; i < final_curve.size(); i++)
+    }
+}
+
+bool GumTrimLine(std::string input_file, std::string label_file, std::string frame_file, std::string output_file, int smooth, double fix_factor,
+    double roi_width, bool roi_geodesic, double proxy_ratio)
+{
+    return GumTrimLine(input_file, label_file, frame_file, std::vector<std::string>{ output_file }, smooth, fix_factor, roi_width, roi_geodesic, proxy_ratio);
+}
+
+bool GumTrimLine(std::string input_file, std::string label_file, std::string frame_file, const std::vector<std::string>& output_files, int smooth,
+    double fix_factor, double roi_width, bool roi_geodesic, double proxy_ratio)
+{
+    GumTrimLineJob job;
+    job.input_file = input_file;
+    job.label_file = label_file;
+    job.frame_file = frame_file;
+    job.smooth = smooth;
+    job.fix_factor = fix_factor;
+    job.roi_width = roi_width;
+    job.roi_geodesic = roi_geodesic;
+    job.proxy_ratio = proxy_ratio;
+    Polyhedron mesh;
+    LoadJobMesh(job, mesh);
+    double deviation = 0.0;
+    auto final_curve = JobCurve(mesh, input_file, job, deviation);
+    ORTHO_PROFILE_SCOPE("write");
+    const std::vector<Point_3> points = final_curve.GetPoints();
+    std::vector<int> labels(final_curve.size());
+    for(size_t i = 0; i < labels.size(); i++)
+    {
+        labels[i] = std::as_const(final_curve).Label(i);
+    }
+    bool success = true;
+    for(const auto& path : output_files)
+    {
+        if(!WriteTrimLine(points, labels, path))
         {
-            final_curve[i] = new_points[i];
+            printf("Cannot write %s.\n", path.c_str());
+            success = false;
         }
     }
+    return success;
+}
 
-    return WritePoints(final_curve.GetPoints(), output_file);
+GumTrimLineResult ComputeGumTrimLine(const GumTrimLineJob& job)
+{
+    Polyhedron mesh;
+    LoadJobMesh(job, mesh);
+    GumTrimLineResult result;
+    auto curve = JobCurve(mesh, job.vertices.empty() ? job.input_file : "mesh arrays", job, result.deviation);
+    result.points.reserve(curve.size() * 3);
+    result.labels.reserve(curve.size());
+    for(size_t i = 0; i < curve.size(); i++)
+    {
+        const auto& p = std::as_const(curve)[i];
+        result.points.insert(result.points.end(), { p.x(), p.y(), p.z() });
+        result.labels.push_back(std::as_const(curve).Label(i));
+    }
+    return result;
+}
+
+std::vector<GumTrimLineResult> ComputeGumTrimLines(const std::vector<GumTrimLineJob>& jobs, int nb_threads)
+{
+    std::vector<GumTrimLineResult> results(jobs.size());
+    auto errors = RunParallelJobs(static_cast<int>(jobs.size()), nb_threads, [&](int i) { results[i] = ComputeGumTrimLine(jobs[i]); });
+    for(size_t i = 0; i < jobs.size(); i++)
+    {
+        if(errors[i])
+        {
+            try
+            {
+                std::rethrow_exception(errors[i]);
+            }
+            catch(const std::exception& e)
+            {
+                results[i].error = e.what();
+            }
+            catch(...)
+            {
+                results[i].error = "unknown error";
+            }
+        }
+    }
+    return results;
 }
@@ -1,8 +1,10 @@
 #ifndef GUMTRIMLINE_H
 #define GUMTRIMLINE_H
 
+#include <algorithm>
 #include <array>
 #include <functional>
+#include <span>
 #include <string>
 #include <vector>
 #include <iterator>
@@ -16,6 +18,8 @@
 #include "../EasyOBJ.h"
 #include "../print.h"
 #include "../Ortho.h"
+#include "../LabelTransfer.h"
+#include "../Projection.h"
 
 namespace internal
 {
@@ -34,11 +38,21 @@ namespace internal
 
         void AddPoint(Point_3 p, int label)
         {
+            if(_moments_valid)
+            {
+                _moments[label].Add(p);
+                if(!_points.empty())
+                {
+                    _cross_sum = _cross_sum + EdgeCross(p, _points.back()) + EdgeCross(_points.front(), p) - EdgeCross(_points.front(), _points.back());
+                }
+            }
             _points.push_back(p);
             _labels.push_back(label);
         }
+        // Non-const access may move points or change labels, so the label moments are recomputed on the next use.
         Point_3& operator[](size_t i)
         {
+            _moments_valid = false;
             return _points[i];
         }
         const Point_3& operator[](size_t i) const
@@ -47,6 +61,7 @@ namespace internal
         }
         int& Label(size_t i)
         {
+            _moments_valid = false;
             return _labels[i];
         }
         const int& Label(size_t i) const
@@ -55,34 +70,19 @@ namespace internal
         }
         void UpdateData()
         {
-            std::unordered_map<int, std::vector<Point_3>> labelwise_points;
-            for(size_t i = 0; i < _points.size(); i++)
+            UpdateMoments();
+            for(const auto& [label, moments] : _moments)
             {
-                labelwise_points[_labels[i]].push_back(_points[i]);
-            }
-            for(const auto& [label, points] : labelwise_points)
-            {
-                typename Kernel::Point_3 c;
-                typename Kernel::Plane_3 plane;
-                CGAL::linear_least_squares_fitting_3(points.begin(), points.end(), plane, c, CGAL::Dimension_tag<0>());
-                _centroids.insert({label, c});
-                typename Kernel::Vector_3 dir = plane.perpendicular_line(c).direction().to_vector();
-                _upwards.insert({label, dir});
+                _centroids.insert({label, moments.Centroid()});
+                _upwards.insert({label, moments.PlaneNormal()});
             }
 
             // unify all directions. Is this robust?
+            // The signed volume spanned by each up axis and the curve edges does not depend on the point taken on
+            // the axis; summed over the closed curve it is up * sum(p[i + 1] x p[i]).
             for(auto& [label, dir] : _upwards)
             {
-                auto p0 = _centroids[label];
-                auto p1 = p0 + dir;
-                double signed_v = 0.0;
-                for(size_t i = 0; i < _points.size(); i++)
-                {
-                    auto p2 = _points[(i + 1) % _points.size()];
-                    auto p3 = _points[i];
-                    signed_v += CGAL::determinant(p1 - p0, p2 - p0, p3 - p0);
-                }
-                if(signed_v < 0)
+                if(dir * _cross_sum < 0)
                 {
                     dir = -dir;
                 }
@@ -143,27 +143,73 @@ namespace internal
         }
         size_t size() const { return _points.size(); }
         std::vector<Point_3> GetPoints() const { return _points; }
+        // Project the points of polyline, a smoothed copy of this curve, with a TFaceHintProjector, using the
+        // faces hit by the previous call as hints. The points are projected in the polyline, so smoothing loops need
+        // not copy the curve in and out of it every step; the curve points are not updated.
+        template <typename Projector, typename Polyline>
+        void ProjectCoherent(const Projector& projector, Polyline& polyline)
+        {
+            _moments_valid = false;
+            if(_face_hints.size() != polyline.size())
+            {
+                _face_hints.assign(polyline.size(), Projector::npos);
+            }
+            projector.Project(polyline.Coords(0), polyline.Coords(1), polyline.Coords(2), std::span<size_t>(_face_hints));
+        }
         Point_3 GetCentroidOfLabel(int label) const { return _centroids.at(label); }
         Vector_3 GetUpwardOfLabel(int label) const { return _upwards.at(label); }
         Curve<Kernel> GetSubCurve(size_t first, size_t last) const
         {
-            if(first >= _points.size() || last >= _points.size())
+            Curve<Kernel> subcurve;
+            subcurve.AppendRange(*this, first, last);
+            return subcurve;
+        }
+        // Append the points of curve from first to last, going forward and wrapping around. If first == last the
+        // whole curve is appended and first appears at both ends.
+        void AppendRange(const Curve<Kernel>& curve, size_t first, size_t last)
+        {
+            if(first >= curve._points.size() || last >= curve._points.size())
             {
                 throw std::range_error("out of curve range");
             }
-            Curve<Kernel> subcurve;
             size_t idx = first;
-            subcurve.AddPoint(_points[idx], _labels[idx]);
+            AddPoint(curve._points[idx], curve._labels[idx]);
             do
             {
                 idx++;
-                if(idx == _points.size())
+                if(idx == curve._points.size())
                 {
                     idx = 0;
                 }
-                subcurve.AddPoint(_points[idx], _labels[idx]);
+                AddPoint(curve._points[idx], curve._labels[idx]);
             } while (idx != last);
-            return subcurve;
+        }
+        // Keep only the points GetSubCurve(first, last) would return, rearranging this curve in place.
+        // Centroids, directions and label order are cleared; call UpdateData again.
+        void KeepRange(size_t first, size_t last)
+        {
+            if(first >= _points.size() || last >= _points.size())
+            {
+                throw std::range_error("out of curve range");
+            }
+            size_t count = first == last ? _points.size() + 1 : (last + _points.size() - first) % _points.size() + 1;
+            std::rotate(_points.begin(), _points.begin() + first, _points.end());
+            std::rotate(_labels.begin(), _labels.begin() + first, _labels.end());
+            if(count > _points.size())
+            {
+                _points.push_back(_points.front());
+                _labels.push_back(_labels.front());
+            }
+            else
+            {
+                _points.resize(count);
+                _labels.resize(count);
+            }
+            _moments_valid = false;
+            _face_hints.clear();
+            _centroids.clear();
+            _upwards.clear();
+            _ordered_labels.clear();
         }
         Curve<Kernel> GetSubCurve(const const_iterator& first, const const_iterator& last) const
         {
@@ -179,11 +225,31 @@ namespace internal
             {
                 throw std::range_error("out of curve range");
             }
+            if(_moments_valid && !curve._points.empty())
+            {
+                curve.UpdateMoments();
+                for(const auto& [label, moments] : curve._moments)
+                {
+                    _moments[label].Add(moments);
+                }
+                // replace the edge across pos by the edges of curve without its closing one
+                Vector_3 inner = curve._cross_sum - EdgeCross(curve._points.front(), curve._points.back());
+                if(_points.empty())
+                {
+                    _cross_sum = curve._cross_sum;
+                }
+                else
+                {
+                    const Point_3& before = _points[(pos + _points.size() - 1) % _points.size()];
+                    const Point_3& after = _points[pos % _points.size()];
+                    _cross_sum = _cross_sum + inner - EdgeCross(after, before) + EdgeCross(curve._points.front(), before) + EdgeCross(after, curve._points.back());
+                }
+            }
             _points.insert(_points.begin() + pos, curve._points.begin(), curve._points.end());
             _labels.insert(_labels.begin() + pos, curve._labels.begin(), curve._labels.end());
         }
-        std::vector<Point_3>::iterator begin() { return _points.begin(); }
-        std::vector<Point_3>::iterator end() { return _points.end(); }
+        std::vector<Point_3>::iterator begin() { _moments_valid = false; return _points.begin(); }
+        std::vector<Point_3>::iterator end() { _moments_valid = false; return _points.end(); }
         std::vector<Point_3>::const_iterator begin() const { return _points.begin(); }
         std::vector<Point_3>::const_iterator end() const { return _points.end(); }
         void WriteOBJ(const std::string& path) const
@@ -245,66 +311,62 @@ namespace internal
         {
             return CurveIterator<const Curve<Kernel>>(this, pos);
         }
-        template <typename AABBTree>
-        void FixShape(int label, const AABBTree& guide_mesh, double fix_factor)
+        // Runs of consecutive points with the given label, as point indices in curve order.
+        std::vector<std::vector<size_t>> LabelSegments(int label) const
         {
-            if(_points.size() <= 2)
+            std::vector<std::vector<size_t>> segs;
+            const size_t n = _points.size();
+            size_t start = 0;
+            while(start < n && !(_labels[start] == label && _labels[(start + n - 1) % n] != label))
             {
-                return;
+                start++;
             }
-            std::vector<std::vector<iterator>> segs;
-            iterator start_pos = CreateIterator(0);
-            int cnt = 0;
-            while(start_pos.Label() != label)
+            if(start == n)
             {
-                start_pos++;
-                if(++cnt >= _points.size())
-                {
-                    return;
-                }
+                return segs;
             }
-            cnt = 0;
-            while(start_pos.Label() == label)
+            for(size_t k = 0; k < n; k++)
             {
-                start_pos--;
-                if(++cnt >= _points.size())
+                size_t i = (start + k) % n;
+                if(_labels[i] == label)
                 {
-                    return;
+                    if(k == 0 || _labels[(i + n - 1) % n] != label)
+                    {
+                        segs.emplace_back();
+                    }
+                    segs.back().push_back(i);
                 }
             }
-            start_pos++;
-            if(start_pos.Label() == label)
+            return segs;
+        }
+        template <typename AABBTree>
+        void FixShape(int label, const AABBTree& guide_mesh, double fix_factor)
+        {
+            if(_points.size() <= 2)
             {
-                segs.emplace_back();
+                return;
             }
-            else
+            auto segs = LabelSegments(label);
+            if(segs.size() <= 1)
             {
                 return;
             }
-            iterator end_pos = start_pos;
-            iterator it = start_pos;
-            do
+            ProjectOnto(guide_mesh, FixSegments(label, segs, guide_mesh));
+        }
+        // Straighten the runs of label where they break away from the tooth outline. Only points of the runs
+        // are moved, their neighbors are read. The points that still need projection onto guide_mesh are returned.
+        template <typename AABBTree>
+        std::vector<size_t> FixSegments(int label, const std::vector<std::vector<size_t>>& seg_ids, const AABBTree& guide_mesh)
+        {
+            std::vector<size_t> to_project_last;
+            std::vector<std::vector<iterator>> segs;
+            for(auto& ids : seg_ids)
             {
-                if(it.Label() == label)
-                {
-                    segs.back().push_back(it);
-                }
-                else
+                auto& seg = segs.emplace_back();
+                for(size_t idx : ids)
                 {
-                    if(!segs.back().empty())
-                    {
-                        segs.emplace_back();
-                    }
+                    seg.push_back(CreateIterator(idx));
                 }
-                it++;
-            }while(it != end_pos);
-            if(segs.back().empty())
-            {
-                segs.pop_back();
-            }
-            if(segs.size() == 1)
-            {
-                return;
             }
             auto tooth_dir = _upwards.at(label);
             typename Kernel::Line_3 tooth_axis(_centroids[label], _upwards[label]);
@@ -356,13 +418,12 @@ namespace internal
                                 it++;
                             }
                         }
-                        it = break_start + 1;
-                        while(it != break_end)
+                        std::vector<size_t> to_project;
+                        for(it = break_start + 1; it != break_end; it++)
                         {
-                            it.Point() = guide_mesh.closest_point(it.Point());
-                            //file.AddV(it.Point(), 1, 0, 0);
-                            it++;
+                            to_project.push_back(it.Idx());
                         }
+                        ProjectOnto(guide_mesh, to_project);
                     }
                     else
                     {
@@ -403,13 +464,12 @@ namespace internal
                                 it--;
                             }
                         }
-                        it = break_start - 1;
-                        while(it != break_end)
+                        std::vector<size_t> to_project;
+                        for(it = break_start - 1; it != break_end; it--)
                         {
-                            it.Point() = guide_mesh.closest_point(it.Point());
-                            //file.AddV(it.Point(), 1, 0, 0);
-                            it--;
+                            to_project.push_back(it.Idx());
                         }
+                        ProjectOnto(guide_mesh, to_project);
                     }
                     else
                     {
@@ -429,28 +489,214 @@ namespace internal
                         seg[k].Point() = CGAL::midpoint((seg[k] - 1).Point(), (seg[k] + 1).Point());
                     }
                 }
-                for(int k = 1; k < seg.size() - 1; k++)
+                for(size_t k = 1; k + 1 < seg.size(); k++)
                 {
-                    seg[k].Point() = guide_mesh.closest_point(seg[k].Point());
+                    to_project_last.push_back(seg[k].Idx());
                 }
             }
+            return to_project_last;
         }
         template <typename AABBTree>
         void FixAllCurve(const AABBTree& guide_mesh, double fix_factor)
         {
             printf("Adjusting curve...\n");
-            std::unordered_set<int> all_labels(_labels.begin(), _labels.end());
-            for(int label : all_labels)
+            if(_points.size() <= 2)
+            {
+                return;
+            }
+            std::vector<int> labels;
+            for(int label : std::unordered_set<int>(_labels.begin(), _labels.end()))
             {
                 if(label % 10 <= 4)
                 {
-                    FixShape(label, guide_mesh, fix_factor);
+                    labels.push_back(label);
+                }
+            }
+            std::sort(labels.begin(), labels.end());
+
+            // Labels own disjoint runs of points but read the point before and after each run, so each label is
+            // fixed on a small curve holding only its runs and these neighbors, and the moved points are written
+            // back afterwards.
+            std::vector<std::vector<std::vector<size_t>>> segs(labels.size());
+            std::vector<std::vector<Point_3>> moved(labels.size());
+            std::vector<std::vector<size_t>> to_project(labels.size());
+            std::vector<std::exception_ptr> errors(labels.size());
+#pragma omp parallel for schedule(dynamic)
+            for(int i = 0; i < labels.size(); i++)
+            {
+                segs[i] = LabelSegments(labels[i]);
+                if(segs[i].size() <= 1)
+                {
+                    continue;
+                }
+                try
+                {
+                    const size_t n = _points.size();
+                    Curve<Kernel> work;
+                    work._centroids[labels[i]] = _centroids.at(labels[i]);
+                    work._upwards[labels[i]] = _upwards.at(labels[i]);
+                    std::vector<size_t> original; // index in this curve of each point of work
+                    std::vector<std::vector<size_t>> work_segs;
+                    for(auto& seg : segs[i])
+                    {
+                        auto& work_seg = work_segs.emplace_back();
+                        std::vector<size_t> ids;
+                        ids.push_back((seg.front() + n - 1) % n);
+                        ids.insert(ids.end(), seg.begin(), seg.end());
+                        ids.push_back((seg.back() + 1) % n);
+                        for(size_t k = 0; k < ids.size(); k++)
+                        {
+                            if(k > 0 && k + 1 < ids.size())
+                            {
+                                work_seg.push_back(work.size());
+                            }
+                            work.AddPoint(_points[ids[k]], _labels[ids[k]]);
+                            original.push_back(ids[k]);
+                        }
+                    }
+                    for(size_t idx : work.FixSegments(labels[i], work_segs, guide_mesh))
+                    {
+                        to_project[i].push_back(original[idx]);
+                    }
+                    for(auto& work_seg : work_segs)
+                    {
+                        for(size_t idx : work_seg)
+                        {
+                            moved[i].push_back(work._points[idx]);
+                        }
+                    }
+                }
+                catch(...)
+                {
+                    errors[i] = std::current_exception();
+                }
+            }
+
+            std::vector<size_t> all_to_project;
+            for(size_t i = 0; i < labels.size(); i++)
+            {
+                if(errors[i])
+                {
+                    std::rethrow_exception(errors[i]);
                 }
+                size_t k = 0;
+                for(auto& seg : segs[i])
+                {
+                    for(size_t idx : seg)
+                    {
+                        _points[idx] = moved[i][k++];
+                    }
+                }
+                all_to_project.insert(all_to_project.end(), to_project[i].begin(), to_project[i].end());
             }
+            _moments_valid = false;
+            ProjectOnto(guide_mesh, all_to_project);
         }
     protected:
+        // Running sums of the points of one label, enough for the least squares plane through them.
+        struct LabelMoments
+        {
+            size_t _n = 0;
+            std::array<double, 3> _sum{};
+            std::array<double, 6> _sum2{}; // xx, xy, xz, yy, yz, zz
+
+            void Add(const Point_3& p)
+            {
+                const double c[3] = { p.x(), p.y(), p.z() };
+                _n++;
+                for(int i = 0, k = 0; i < 3; i++)
+                {
+                    _sum[i] += c[i];
+                    for(int j = i; j < 3; j++, k++)
+                    {
+                        _sum2[k] += c[i] * c[j];
+                    }
+                }
+            }
+
+            void Add(const LabelMoments& m)
+            {
+                _n += m._n;
+                for(int i = 0; i < 3; i++)
+                    _sum[i] += m._sum[i];
+                for(int k = 0; k < 6; k++)
+                    _sum2[k] += m._sum2[k];
+            }
+
+            Point_3 Centroid() const
+            {
+                return Point_3(_sum[0] / _n, _sum[1] / _n, _sum[2] / _n);
+            }
+
+            // Normal of the plane fitted by linear_least_squares_fitting_3: the eigenvector of the smallest
+            // eigenvalue of the covariance, or z if the points are isotropic.
+            Vector_3 PlaneNormal() const
+            {
+                Eigen::Matrix3d cov;
+                for(int i = 0, k = 0; i < 3; i++)
+                {
+                    for(int j = i; j < 3; j++, k++)
+                    {
+                        cov(i, j) = cov(j, i) = _sum2[k] - _sum[i] * _sum[j] / _n;
+                    }
+                }
+                Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver(cov);
+                const auto& values = solver.eigenvalues();
+                if(values[0] == values[1] && values[1] == values[2])
+                {
+                    return Vector_3(0, 0, 1);
+                }
+                const auto& v = solver.eigenvectors().col(0);
+                return Vector_3(v[0], v[1], v[2]);
+            }
+        };
+
+        static Vector_3 EdgeCross(const Point_3& p1, const Point_3& p0)
+        {
+            return CGAL::cross_product(p1 - CGAL::ORIGIN, p0 - CGAL::ORIGIN);
+        }
+
+        // Recompute the moments from scratch if points were modified in place.
+        void UpdateMoments() const
+        {
+            if(_moments_valid)
+            {
+                return;
+            }
+            _moments.clear();
+            _cross_sum = CGAL::NULL_VECTOR;
+            for(size_t i = 0; i < _points.size(); i++)
+            {
+                _moments[_labels[i]].Add(_points[i]);
+                _cross_sum = _cross_sum + EdgeCross(_points[(i + 1) % _points.size()], _points[i]);
+            }
+            _moments_valid = true;
+        }
+
+        // Move the curve points at the given indices to their closest points on the guide mesh.
+        template <typename AABBTree>
+        void ProjectOnto(const AABBTree& guide_mesh, const std::vector<size_t>& indices)
+        {
+            std::vector<Point_3> points(indices.size());
+            for(size_t i = 0; i < indices.size(); i++)
+            {
+                points[i] = _points[indices[i]];
+            }
+            BatchClosestPoints(guide_mesh, points);
+            for(size_t i = 0; i < indices.size(); i++)
+            {
+                _points[indices[i]] = points[i];
+            }
+            _moments_valid = false;
+        }
+
         std::vector<Point_3> _points;
         std::vector<int> _labels;
+        std::vector<size_t> _face_hints;
+        // per-label point moments and sum(p[i + 1] x p[i]), kept up to date by AddPoint and InsertAt.
+        mutable std::unordered_map<int, LabelMoments> _moments;
+        mutable Vector_3 _cross_sum = CGAL::NULL_VECTOR;
+        mutable bool _moments_valid = true;
         std::unordered_map<int, Point_3> _centroids;
         std::unordered_map<int, Vector_3> _upwards;
         std::vector<int> _ordered_labels;
@@ -578,8 +824,54 @@ namespace internal
         size_t _pos;
     };
 
+    // Points of the quadratic Bezier curve (p0, p1, p2) at t = i / segments, 0 < i < segments.
+    template <typename Kernel>
+    std::vector<typename Kernel::Point_3> QuadraticBezierInterior(const typename Kernel::Point_3& p0, const typename Kernel::Point_3& p1,
+        const typename Kernel::Point_3& p2, int segments)
+    {
+        const int n = std::max(segments - 1, 0);
+        std::array<std::vector<double>, 3> coords;
+        for(int axis = 0; axis < 3; axis++)
+        {
+            const double c0 = p0[axis], c1 = p1[axis], c2 = p2[axis];
+            coords[axis].resize(n);
+            double* out = coords[axis].data();
+#pragma omp simd
+            for(int i = 0; i < n; i++)
+            {
+                double t = (double)(i + 1) / segments;
+                out[i] = (1.0 - t) * (1.0 - t) * c0 + 2.0 * t * (1.0 - t) * c1 + t * t * c2;
+            }
+        }
+        std::vector<typename Kernel::Point_3> points;
+        points.reserve(n);
+        for(int i = 0; i < n; i++)
+        {
+            points.emplace_back(coords[0][i], coords[1][i], coords[2][i]);
+        }
+        return points;
+    }
+
+    // Fraction of the points whose closest face on guide_mesh is labeled, with one batched projection.
+    template <typename AABBTree>
+    double LabeledFraction(const AABBTree& guide_mesh, const std::vector<typename AABBTree::Point>& points)
+    {
+        if(points.empty())
+        {
+            return 0.0;
+        }
+        std::vector<typename AABBTree::Point> closest(points.size());
+        std::vector<typename AABBTree::Primitive_id> faces(points.size());
+        BatchClosestPoints(guide_mesh, std::span<const typename AABBTree::Point>(points),
+            std::span<typename AABBTree::Point>(closest), std::span<typename AABBTree::Primitive_id>(faces));
+        size_t cnt = std::count_if(faces.begin(), faces.end(), [](const auto& hf) { return hf->_label != 0; });
+        return (double)cnt / points.size();
+    }
+
+    // Join curve0 to curve1 at the max label of curve0 and the min label of curve1. The result reuses the
+    // storage of curve0, so pass it as an rvalue when it is not needed afterwards.
     template <typename Kernel, typename AABBTree>
-    Curve<Kernel> Merge(const Curve<Kernel> &curve0, const Curve<Kernel> &curve1, const AABBTree& guide_mesh )
+    Curve<Kernel> Merge(Curve<Kernel> curve0, const Curve<Kernel> &curve1, const AABBTree& guide_mesh )
     {
         // if(curve0.MaxLabel() > curve1.MinLabel())
         // {
@@ -632,10 +924,10 @@ namespace internal
 
         bool found_fail1 = true;
         bool found_fail2 = true;
-        auto closest_its = std::make_pair(curve0.CreateIterator(0), curve1.CreateIterator(0));
+        auto closest_its = std::make_pair(curve0.CreateConstIterator(0), curve1.CreateIterator(0));
         {
             double min_dist = std::numeric_limits<double>::max();
-            auto it = curve0.CreateIterator(0);
+            auto it = curve0.CreateConstIterator(0);
             auto end = it;
             do
             {
@@ -675,33 +967,39 @@ namespace internal
         if(found_fail1 || found_fail2)
         {
             printf("Warning: failed to found closest merge pair. It may caused by bad geom or unknown bug. A trival searching method will be applied.\n");
-            auto it0 = curve0.CreateIterator(0);
-            auto end0 = it0;
-            double min_dist = std::numeric_limits<double>::max();
-            do
+            // closest pair of a max label point of curve0 and a min label point of curve1, with a kd-tree over the latter.
+            std::vector<typename Kernel::Point_3> points1;
+            std::vector<int> labels1;
+            std::vector<size_t> indices1;
+            for(size_t i = 0; i < curve1.size(); i++)
             {
-                auto it1 = curve1.CreateIterator(0);
-                auto end1 = it1;
-                if(it0.Label() != curve0.MaxLabel())
+                if(curve1.Label(i) == curve1.MinLabel())
                 {
-                    continue;
+                    points1.push_back(curve1[i]);
+                    labels1.push_back(curve1.Label(i));
+                    indices1.push_back(i);
                 }
-                do
+            }
+            if(!points1.empty())
+            {
+                TNearestLabelSearch<Kernel> search(std::move(points1), std::move(labels1));
+                double min_dist = std::numeric_limits<double>::max();
+                for(size_t i = 0; i < curve0.size(); i++)
                 {
-                    if(it1.Label() == curve1.MinLabel())
+                    if(curve0.Label(i) != curve0.MaxLabel())
                     {
-                        double curr_dist = CGAL::squared_distance(it0.Point(), it1.Point());
-                        if(curr_dist < min_dist)
-                        {
-                            closest_its.first = it0;
-                            closest_its.second = it1;
-                            min_dist = curr_dist;
-                        }
+                        continue;
                     }
-                    it1++;
-                } while (it1 != end1);
-                it0++;
-            } while (it0 != end0);
+                    size_t j = indices1[search.NearestIndex(curve0[i])];
+                    double curr_dist = CGAL::squared_distance(curve0[i], curve1[j]);
+                    if(curr_dist < min_dist)
+                    {
+                        closest_its.first = curve0.CreateConstIterator(i);
+                        closest_its.second = curve1.CreateIterator(j);
+                        min_dist = curr_dist;
+                    }
+                }
+            }
         }
         
         closest_pair.first = closest_its.first.Idx();
@@ -892,21 +1190,12 @@ namespace internal
                 typename Kernel::Point_3 pos1 = end_it.second.Point();
                 typename Kernel::Point_3 mid = CGAL::midpoint(pos0, pos1);
                 mid = CGAL::midpoint(connecting_plane.projection(mid), mid);
-                for(int i = 1; i < 40; i++)
-                {
-                    double t = (double)i / 40.0;
-                    typename Kernel::Vector_3 p = (1.0 - t) * (1.0 - t) * (pos0 - CGAL::ORIGIN) + 2.0 * t * (1.0 - t) * (mid - CGAL::ORIGIN) + t * t * (pos1 - CGAL::ORIGIN);
-                    midcurve1.AddPoint(CGAL::ORIGIN + p, start_it.first.Label());
-                }
-                error = 0.0;
-                for(size_t i = 0; i < midcurve1.size(); i++)
+                auto samples = QuadraticBezierInterior<Kernel>(pos0, mid, pos1, 40);
+                for(const auto& p : samples)
                 {
-                    if(guide_mesh.closest_point_and_primitive(midcurve1[i]).second->_label != 0)
-                    {
-                        error += 1.0;
-                    }
+                    midcurve1.AddPoint(p, start_it.first.Label());
                 }
-                error /= midcurve1.size();
+                error = LabeledFraction(guide_mesh, samples);
                 if(error < 0.3)
                 {
                     break;
@@ -932,21 +1221,12 @@ namespace internal
                 typename Kernel::Point_3 pos1 = end_it.first.Point();
                 typename Kernel::Point_3 mid = CGAL::midpoint(pos0, pos1);
                 mid = CGAL::midpoint(connecting_plane.projection(mid), mid);
-                for(int i = 1; i < 40; i++)
+                auto samples = QuadraticBezierInterior<Kernel>(pos0, mid, pos1, 40);
+                for(const auto& p : samples)
                 {
-                    double t = (double)i / 40.0;
-                    typename Kernel::Vector_3 p = (1.0 - t) * (1.0 - t) * (pos0 - CGAL::ORIGIN) + 2.0 * t * (1.0 - t) * (mid - CGAL::ORIGIN) + t * t * (pos1 - CGAL::ORIGIN);
-                    midcurve2.AddPoint(CGAL::ORIGIN + p, end_it.first.Label());
+                    midcurve2.AddPoint(p, end_it.first.Label());
                 }
-                error = 0.0;
-                for(size_t i = 0; i < midcurve2.size(); i++)
-                {
-                    if(guide_mesh.closest_point_and_primitive(midcurve2[i]).second->_label != 0)
-                    {
-                        error += 1.0;
-                    }
-                }
-                error /= midcurve2.size();
+                error = LabeledFraction(guide_mesh, samples);
                 if(error < 0.3)
                 {
                     break;
@@ -961,37 +1241,12 @@ namespace internal
                 }
             }while(max_try > 0);
         }
-        Curve<Kernel> subcurve1 = curve0.GetSubCurve(end_it.first, start_it.first);
-        Curve<Kernel> subcurve2 = curve1.GetSubCurve(end_it.second, start_it.second);
-
-        if(midcurve1.size() >= 3)
-        {
-            for(int j = 0; j < 0; j++)
-            {
-                midcurve1[0] = CGAL::midpoint(midcurve1[1], subcurve1[subcurve1.size() - 1]);
-                midcurve1[midcurve1.size() - 1] = CGAL::midpoint(midcurve1[midcurve1.size() - 2], subcurve2[0]);
-                for(int k = 1; k < midcurve1.size() - 1; k++)
-                {
-                    midcurve1[k] = CGAL::midpoint(midcurve1[k - 1], midcurve1[k + 1]);
-                }
-            }
-        }
-        if(midcurve2.size() >= 3)
-        {
-            for(int j = 0; j < 0; j++)
-            {
-                midcurve2[0] = CGAL::midpoint(midcurve2[1], subcurve2[subcurve2.size() - 1]);
-                midcurve2[midcurve2.size() - 1] = CGAL::midpoint(midcurve2[midcurve2.size() - 2], subcurve1[0]);
-                for(int k = 1; k < midcurve1.size() - 1; k++)
-                {
-                    midcurve2[k] = CGAL::midpoint(midcurve2[k - 1], midcurve2[k + 1]);
-                }
-            }
-        }
-
-        Curve<Kernel> result_curve = subcurve1;
+        const size_t first0 = end_it.first.Idx();
+        const size_t last0 = start_it.first.Idx();
+        Curve<Kernel> result_curve = std::move(curve0);
+        result_curve.KeepRange(first0, last0);
         result_curve.InsertAt(midcurve1, result_curve.size());
-        result_curve.InsertAt(subcurve2, result_curve.size());
+        result_curve.AppendRange(curve1, end_it.second.Idx(), start_it.second.Idx());
         result_curve.InsertAt(midcurve2, result_curve.size());
 
         //std::ofstream ofs("./merge.obj");
@@ -1023,6 +1278,47 @@ namespace internal
 }
 
 
-bool GumTrimLine( std::string input_file, std::string label_file, std::string frame_file, std::string output_file, int smooth, double fix_factor );
+// roi_width > 0 restricts the projections to the faces within that distance of the label borders (geodesic or
+// Euclidean), which saves most of the tree building on full scans. 0 < proxy_ratio < 1 finds the trim line on a
+// copy decimated to that ratio of edges and projects it back onto the mesh, trading accuracy for speed.
+bool GumTrimLine( std::string input_file, std::string label_file, std::string frame_file, std::string output_file, int smooth, double fix_factor,
+    double roi_width = 0.0, bool roi_geodesic = false, double proxy_ratio = 0.0 );
+// Write the same trim line to several files. The extension selects the format: .obj (segment list), .json,
+// .npy (N x 4 float64, x y z label), .bin (float32) or .bin64 (float64).
+bool GumTrimLine( std::string input_file, std::string label_file, std::string frame_file, const std::vector<std::string>& output_files, int smooth,
+    double fix_factor, double roi_width = 0.0, bool roi_geodesic = false, double proxy_ratio = 0.0 );
+
+// Input of one trim line computation. The mesh is read from input_file and label_file if vertices is empty,
+// otherwise it is built from the x, y, z coordinates in vertices, the vertex indices of the triangles in faces
+// and one label per vertex in labels.
+struct GumTrimLineJob
+{
+    std::string input_file;
+    std::string label_file;
+    std::string frame_file;
+    std::vector<double> vertices;
+    std::vector<int> faces;
+    std::vector<int> labels;
+    int smooth = 3;
+    double fix_factor = 0.0;
+    double roi_width = 0.0;
+    bool roi_geodesic = false;
+    double proxy_ratio = 0.0;
+};
+
+struct GumTrimLineResult
+{
+    std::vector<double> points; // x, y, z of each trim line point
+    std::vector<int> labels;    // tooth label of each point
+    double deviation = 0.0;     // largest distance from the proxy trim line to the gum borders of the mesh, 0 without proxy
+    std::string error;          // set if the job failed
+};
+
+GumTrimLineResult ComputeGumTrimLine( const GumTrimLineJob& job );
+
+// Run the jobs on up to nb_threads threads (all available if nb_threads <= 0). Jobs run concurrently and share
+// the threads, so an upper and lower arch pair runs at once with half of them each. A failed job sets the
+// error of its result and does not stop the others.
+std::vector<GumTrimLineResult> ComputeGumTrimLines( const std::vector<GumTrimLineJob>& jobs, int nb_threads );
 
 #endif
\ No newline at end of file
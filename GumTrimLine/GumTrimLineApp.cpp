@@ -1,17 +1,26 @@
 #include "GumTrimLine.h"
+#include "../ParallelJobs.h"
+#include "../Profiler.h"
 #include <chrono>
 #include <argparse/argparse.hpp>
                                                                                                                                                                                                                                                        
 int main(int argc, char *argv[])
 {
     argparse::ArgumentParser argparse("GumTrimLine");
-    argparse.add_description("Extract gum trim line and output it as an .obj file.");
+    argparse.add_description("Extract gum trim line and output it as .obj, .json, .npy, .bin (float32) or .bin64 (float64) files.");
     argparse.add_argument("--input_file", "-i").required().help("specify the input mesh file.");
     argparse.add_argument("--label_file", "-l").required().help("specify the input label file.");
     argparse.add_argument("--frame_file", "-fr").default_value("").help("specify the crown frame file.");
-    argparse.add_argument("--output_file", "-o").required().help("specify the output file.");
+    argparse.add_argument("--output_file", "-o").required().nargs(argparse::nargs_pattern::at_least_one).help("specify the output files, the format follows the extension.");
     argparse.add_argument("--smooth", "-s").scan<'i', int>().default_value(10).help("a non-nagetive integer that specifies the iteration number of trim line smoothing");
     argparse.add_argument("--fix_factor", "-f").default_value(0.0).scan<'g', double>().help("");
+    argparse.add_argument("--roi").default_value(0.0).scan<'g', double>().help("only project onto faces within this distance of the label borders, 0 to use the whole mesh.");
+    argparse.add_argument("--roi_geodesic").default_value(false).implicit_value(true).help("measure the --roi distance along the mesh edges instead of in a straight line.");
+    argparse.add_argument("--proxy").default_value(0.0).scan<'g', double>().help("extract the trim line on a copy decimated to this ratio of edges (0 to 1) and project it back, faster but less accurate. 0 disables it.");
+    argparse.add_argument("--pair_input_file", "-i2").default_value("").help("specify the scan of the other arch to process at the same time, sharing the threads.");
+    argparse.add_argument("--pair_label_file", "-l2").default_value("").help("specify the label file of the other arch.");
+    argparse.add_argument("--pair_output_file", "-o2").nargs(argparse::nargs_pattern::any).default_value(std::vector<std::string>{}).help("specify the output files of the other arch.");
+    argparse.add_argument("--trace").default_value("").help("write a Chrome trace of the processing stages to this json file (needs a build with ORTHO_PROFILE).");
     try
     {
         argparse.parse_args(argc, argv);
@@ -21,17 +30,54 @@ int main(int argc, char *argv[])
         std::cerr << "Invalid arguments: " << e.what() << '\n';
     }
     
-    try
+    Profiler::Session session(argparse.get("--trace"));
+    std::vector<std::string> input_files = { argparse.get("-i") };
+    std::vector<std::string> label_files = { argparse.get("-l") };
+    std::vector<std::vector<std::string>> output_files = { argparse.get<std::vector<std::string>>("-o") };
+    const std::string pair_input = argparse.get("-i2");
+    const std::string pair_label = argparse.get("-l2");
+    const auto pair_outputs = argparse.get<std::vector<std::string>>("-o2");
+    if(pair_input.empty() != pair_label.empty() || pair_input.empty() != pair_outputs.empty())
     {
-        auto start_time = std::chrono::high_resolution_clock::now();
-        GumTrimLine(argparse.get("-i"), argparse.get("-l"), "", argparse.get("-o"), argparse.get<int>("-s"), argparse.get<double>("-f"));
-        std::cout << "Time = " << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start_time) << std::endl;
-        std::cout << "===============================" << std::endl;
+        std::cerr << "Invalid arguments: the other arch needs all of -i2, -l2 and -o2." << std::endl;
+        return -1;
     }
-    catch(const std::exception& e)
+    if(!pair_input.empty())
     {
-        std::cerr << "GumTrimLine Error: " << e.what() << std::endl;
-        return -1;
+        input_files.push_back(pair_input);
+        label_files.push_back(pair_label);
+        output_files.push_back(pair_outputs);
+    }
+    const int smooth = argparse.get<int>("-s");
+    const double fix_factor = argparse.get<double>("-f");
+    const double roi_width = argparse.get<double>("--roi");
+    const bool roi_geodesic = argparse.get<bool>("--roi_geodesic");
+    const double proxy_ratio = argparse.get<double>("--proxy");
+    auto start_time = std::chrono::high_resolution_clock::now();
+    // one job per arch; a pair runs concurrently with the threads split between them.
+    auto errors = RunParallelJobs(static_cast<int>(input_files.size()), 0, [&](int i) {
+        GumTrimLine(input_files[i], label_files[i], "", output_files[i], smooth, fix_factor, roi_width, roi_geodesic, proxy_ratio);
+    });
+    std::cout << "Time = " << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start_time) << std::endl;
+    std::cout << "===============================" << std::endl;
+    int ret = 0;
+    for(size_t i = 0; i < errors.size(); i++)
+    {
+        try
+        {
+            if(errors[i])
+                std::rethrow_exception(errors[i]);
+        }
+        catch(const std::exception& e)
+        {
+            std::cerr << "GumTrimLine Error (" << input_files[i] << "): " << e.what() << std::endl;
+            ret = -1;
+        }
+        catch(...)
+        {
+            std::cerr << "GumTrimLine Error (" << input_files[i] << "): unknown error" << std::endl;
+            ret = -1;
+        }
     }
-    return 0;
+    return ret;
 }
\ No newline at end of file
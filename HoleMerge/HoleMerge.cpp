@@ -6,6 +6,7 @@
 #include <CGAL/boost/graph/io.h>
 #include <CGAL/Surface_mesh_shortest_path.h>
 #include "../Polyhedron.h"
+#include "../Profiler.h"
 
 namespace
 {
@@ -87,16 +88,13 @@ namespace
 
     CGAL::set_halfedgeds_items_id(mesh);
 
-    auto start = std::chrono::high_resolution_clock::now();
-
-    CGAL::Surface_mesh_shortest_path<SurfaceShortestPathTraits> shortest_paths(mesh);
-    shortest_paths.add_source_point(nearest_pair.first->vertex());
-
     Sequence_collector sc;
-    shortest_paths.shortest_path_sequence_to_source_points(nearest_pair.second->vertex(), sc);
-    auto end = std::chrono::high_resolution_clock::now();
-
-    std::cout << "Distance Time = " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start) << std::endl;
+    {
+      ORTHO_PROFILE_SCOPE("shortest_path");
+      CGAL::Surface_mesh_shortest_path<SurfaceShortestPathTraits> shortest_paths(mesh);
+      shortest_paths.add_source_point(nearest_pair.first->vertex());
+      shortest_paths.shortest_path_sequence_to_source_points(nearest_pair.second->vertex(), sc);
+    }
 
     std::unordered_set<hFacet> faces_to_erase;
     for (auto hv : sc.vertices)
@@ -145,16 +143,29 @@ bool HoleMerge(std::string input_mesh, std::string output_mesh, int threshold)
 {
   auto start = std::chrono::high_resolution_clock::now();
   Polyhedron mesh;
-  if(!CGAL::IO::read_polygon_mesh(input_mesh, mesh))
+  bool loaded = false;
+  {
+    ORTHO_PROFILE_SCOPE("load");
+    loaded = CGAL::IO::read_polygon_mesh(input_mesh, mesh);
+  }
+  if(!loaded)
   {
     std::cout << "Failed to read mesh: " << input_mesh << std::endl;
     return false;
   }
   std::cout << "Read Mesh: " << mesh.size_of_vertices() << ", " << mesh.size_of_facets() << std::endl;
 
-  while (MergeLargestHoles(mesh, threshold)) {}
+  {
+    ORTHO_PROFILE_SCOPE("merge_holes");
+    while (MergeLargestHoles(mesh, threshold)) {}
+  }
 
-  if(!CGAL::IO::write_polygon_mesh(output_mesh, mesh))
+  bool written = false;
+  {
+    ORTHO_PROFILE_SCOPE("write");
+    written = CGAL::IO::write_polygon_mesh(output_mesh, mesh);
+  }
+  if(!written)
   {
     std::cout << "Failed to output mesh: " << output_mesh << std::endl;
     return false;
@@ -172,6 +183,7 @@ int main(int argc, char *argv[])
   std::string input_mesh;
   std::string output_mesh;
   int threshold = 0;
+  std::string trace;
   for (int i = 1; i < argc; i++)
   {
     if (std::strcmp(argv[i], "-i") == 0)
@@ -186,12 +198,17 @@ int main(int argc, char *argv[])
     {
       threshold = std::atoi(argv[i + 1]);
     }
+    else if (std::strcmp(argv[i], "-trace") == 0)
+    {
+      trace = std::string(argv[i + 1]);
+    }
     else if (std::strcmp(argv[i], "-h") == 0)
     {
       std::cout << "Merge multiple holes on the mesh into one hole.\n"
       "-i : file path of input mesh\n"
       "-o : file path of output mesh\n"
-      "-t : an integer threshold value. Holes with edge number smaller than this value will NOT be processed." << std::endl;
+      "-t : an integer threshold value. Holes with edge number smaller than this value will NOT be processed.\n"
+      "-trace : write a Chrome trace of the processing stages to this json file (needs a build with ORTHO_PROFILE)." << std::endl;
       return 0;
     }
   }
@@ -200,6 +217,7 @@ int main(int argc, char *argv[])
     std::cout << "Invalid paramters. Use -h for help." << std::endl;
     return -1;
   }
+  Profiler::Session session(trace);
   if(!HoleMerge(input_mesh, output_mesh, threshold))
   {
     return -1;
@@ -0,0 +1,164 @@
+#ifndef LABEL_TRANSFER_H
+#define LABEL_TRANSFER_H
+#include <unordered_set>
+#include <vector>
+#include <boost/iterator/counting_iterator.hpp>
+#include <CGAL/boost/graph/iterator.h>
+#include <CGAL/Orthogonal_k_neighbor_search.h>
+#include <CGAL/Search_traits_3.h>
+#include <CGAL/Search_traits_adapter.h>
+#include "Ortho.h"
+
+namespace internal
+{
+template <typename Point>
+class IndexedPointMap
+{
+public:
+    using value_type = Point;
+    using reference = const value_type&;
+    using key_type = std::size_t;
+    using category = boost::lvalue_property_map_tag;
+
+    IndexedPointMap() = default;
+    IndexedPointMap(const Point* points) : _points(points) {}
+    reference operator[](key_type i) const { return _points[i]; }
+    friend reference get(const IndexedPointMap& map, key_type i) { return map[i]; }
+
+protected:
+    const Point* _points = nullptr;
+};
+}
+
+// kd-tree over a set of labeled points, answering "label of the nearest point" queries.
+template <typename Kernel>
+class TNearestLabelSearch
+{
+public:
+    using Point_3 = typename Kernel::Point_3;
+    using PointMap = internal::IndexedPointMap<Point_3>;
+    using TraitsBase = CGAL::Search_traits_3<Kernel>;
+    using Traits = CGAL::Search_traits_adapter<std::size_t, PointMap, TraitsBase>;
+    using KNeighborSearch = CGAL::Orthogonal_k_neighbor_search<Traits>;
+    using Tree = typename KNeighborSearch::Tree;
+    using Distance = typename KNeighborSearch::Distance;
+
+    TNearestLabelSearch(std::vector<Point_3> points, std::vector<int> labels)
+        : _points(std::move(points)), _labels(std::move(labels)),
+        _tree(boost::counting_iterator<std::size_t>(0), boost::counting_iterator<std::size_t>(_points.size()),
+              typename Tree::Splitter(), Traits(PointMap(_points.data())))
+    {
+        if(_points.size() != _labels.size())
+        {
+            throw AlgError("Number of points != number of labels");
+        }
+        // build here so that concurrent queries only read the tree.
+        _tree.build();
+    }
+    TNearestLabelSearch(const TNearestLabelSearch&) = delete;
+    TNearestLabelSearch& operator=(const TNearestLabelSearch&) = delete;
+
+    bool Empty() const { return _points.empty(); }
+
+    size_t NearestIndex(const Point_3& p) const
+    {
+        KNeighborSearch search(_tree, p, 1, 0, true, Distance(PointMap(_points.data())));
+        return search.begin()->first;
+    }
+
+    int NearestLabel(const Point_3& p) const
+    {
+        return _labels[NearestIndex(p)];
+    }
+
+    std::vector<int> NearestLabels(const std::vector<Point_3>& queries) const
+    {
+        std::vector<int> result(queries.size(), 0);
+#pragma omp parallel for
+        for(int i = 0; i < queries.size(); i++)
+        {
+            result[i] = NearestLabel(queries[i]);
+        }
+        return result;
+    }
+
+protected:
+    std::vector<Point_3> _points;
+    std::vector<int> _labels;
+    Tree _tree;
+};
+
+// Give each target vertex the label of the closest vertex in its surroundings.
+// The surroundings are the one-ring neighbors `nei` of targets `hv` for which is_source(hv, nei) holds.
+template <typename Polyhedron, typename SourcePred>
+void TransferLabelsFromSurroundings(Polyhedron& mesh, const std::vector<typename Polyhedron::Vertex_handle>& targets, SourcePred is_source)
+{
+    using Kernel = typename Polyhedron::Traits;
+    std::unordered_set<typename Polyhedron::Vertex_handle> surroundings;
+    std::vector<typename Kernel::Point_3> source_points;
+    std::vector<int> source_labels;
+    for(auto hv : targets)
+    {
+        for(auto nei : CGAL::vertices_around_target(hv, mesh))
+        {
+            if(is_source(hv, nei) && surroundings.insert(nei).second)
+            {
+                source_points.push_back(nei->point());
+                source_labels.push_back(nei->_label);
+            }
+        }
+    }
+    if(source_points.empty())
+    {
+        return;
+    }
+    TNearestLabelSearch<Kernel> search(std::move(source_points), std::move(source_labels));
+#pragma omp parallel for
+    for(int i = 0; i < targets.size(); i++)
+    {
+        targets[i]->_label = search.NearestLabel(targets[i]->point());
+    }
+}
+
+// Give each target face the label of the face in its surroundings with the closest centroid.
+// The surroundings are the edge-adjacent faces `nei` of targets `hf` for which is_source(hf, nei) holds.
+template <typename Polyhedron, typename SourcePred>
+void TransferFaceLabelsFromSurroundings(Polyhedron& mesh, const std::vector<typename Polyhedron::Facet_handle>& targets, SourcePred is_source)
+{
+    using Kernel = typename Polyhedron::Traits;
+    auto centroid = [](typename Polyhedron::Facet_handle hf) {
+        return CGAL::centroid(hf->halfedge()->vertex()->point(), hf->halfedge()->next()->vertex()->point(), hf->halfedge()->prev()->vertex()->point());
+    };
+    std::unordered_set<typename Polyhedron::Facet_handle> surroundings;
+    std::vector<typename Kernel::Point_3> source_points;
+    std::vector<int> source_labels;
+    for(auto hf : targets)
+    {
+        for(auto nei : CGAL::faces_around_face(hf->halfedge(), mesh))
+        {
+            if(nei != nullptr && is_source(hf, nei) && surroundings.insert(nei).second)
+            {
+                source_points.push_back(centroid(nei));
+                source_labels.push_back(nei->_label);
+            }
+        }
+    }
+    if(source_points.empty())
+    {
+        return;
+    }
+    TNearestLabelSearch<Kernel> search(std::move(source_points), std::move(source_labels));
+    // targets can be sources of each other, so labels are written after all queries.
+    std::vector<int> new_labels(targets.size());
+#pragma omp parallel for
+    for(int i = 0; i < targets.size(); i++)
+    {
+        new_labels[i] = search.NearestLabel(centroid(targets[i]));
+    }
+    for(size_t i = 0; i < targets.size(); i++)
+    {
+        targets[i]->_label = new_labels[i];
+    }
+}
+
+#endif
@@ -0,0 +1,399 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <system_error>
+#include <vector>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include <CGAL/number_utils.h>
+#include "Ortho.h"
+
+namespace internal
+{
+// FNV-1a over 64-bit words (tail bytes zero padded). Used as a content key and checksum, not for security.
+class Fnv1a64
+{
+public:
+    void Add(const void* data, size_t size)
+    {
+        const auto* bytes = static_cast<const unsigned char*>(data);
+        size_t i = 0;
+        for(; i + 8 <= size; i += 8)
+        {
+            uint64_t word;
+            std::memcpy(&word, bytes + i, 8);
+            Mix(word);
+        }
+        if(i < size)
+        {
+            uint64_t word = 0;
+            std::memcpy(&word, bytes + i, size - i);
+            Mix(word);
+        }
+    }
+
+    template <typename T>
+    void Add(const T& value)
+    {
+        Add(&value, sizeof(T));
+    }
+
+    uint64_t Value() const { return _h; }
+
+protected:
+    void Mix(uint64_t word)
+    {
+        _h = (_h ^ word) * 1099511628211ull;
+    }
+
+    uint64_t _h = 14695981039346656037ull;
+};
+}
+
+// Key of a mesh for MeshCache: hash of its vertex coordinates and of the vertex ids of its faces, in
+// iteration order. Vertex ids must be set (CGAL::set_halfedgeds_items_id).
+template <typename Polyhedron>
+uint64_t MeshHash(const Polyhedron& mesh)
+{
+    internal::Fnv1a64 hash;
+    hash.Add(static_cast<uint64_t>(mesh.size_of_vertices()));
+    hash.Add(static_cast<uint64_t>(mesh.size_of_facets()));
+    for(auto hv = mesh.vertices_begin(); hv != mesh.vertices_end(); hv++)
+    {
+        double p[3] = { CGAL::to_double(hv->point().x()), CGAL::to_double(hv->point().y()), CGAL::to_double(hv->point().z()) };
+        hash.Add(p, sizeof(p));
+    }
+    for(auto hf = mesh.facets_begin(); hf != mesh.facets_end(); hf++)
+    {
+        auto hh = hf->halfedge();
+        do
+        {
+            hash.Add(static_cast<uint64_t>(hh->vertex()->id()));
+            hh = hh->next();
+        } while(hh != hf->halfedge());
+        hash.Add(~uint64_t(0));
+    }
+    return hash.Value();
+}
+
+// Read-only memory map of a whole file.
+class MappedFile
+{
+public:
+    explicit MappedFile(const std::filesystem::path& path)
+    {
+#ifdef _WIN32
+        _file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if(_file == INVALID_HANDLE_VALUE)
+            throw IOError("Cannot open " + path.string());
+        LARGE_INTEGER size;
+        GetFileSizeEx(_file, &size);
+        _size = static_cast<size_t>(size.QuadPart);
+        if(_size > 0)
+        {
+            _mapping = CreateFileMappingW(_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if(_mapping != nullptr)
+                _data = static_cast<const std::byte*>(MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0));
+        }
+#else
+        _fd = open(path.c_str(), O_RDONLY);
+        if(_fd < 0)
+            throw IOError("Cannot open " + path.string());
+        struct stat st;
+        fstat(_fd, &st);
+        _size = static_cast<size_t>(st.st_size);
+        if(_size > 0)
+        {
+            void* p = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, _fd, 0);
+            _data = p == MAP_FAILED ? nullptr : static_cast<const std::byte*>(p);
+        }
+#endif
+        if(_size > 0 && _data == nullptr)
+        {
+            Close();
+            throw IOError("Cannot map " + path.string());
+        }
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile()
+    {
+        Close();
+    }
+
+    const std::byte* data() const { return _data; }
+    size_t size() const { return _size; }
+
+protected:
+    void Close()
+    {
+#ifdef _WIN32
+        if(_data != nullptr)
+            UnmapViewOfFile(_data);
+        if(_mapping != nullptr)
+            CloseHandle(_mapping);
+        if(_file != INVALID_HANDLE_VALUE)
+            CloseHandle(_file);
+        _mapping = nullptr;
+        _file = INVALID_HANDLE_VALUE;
+#else
+        if(_data != nullptr)
+            munmap(const_cast<std::byte*>(_data), _size);
+        if(_fd >= 0)
+            close(_fd);
+        _fd = -1;
+#endif
+        _data = nullptr;
+    }
+
+#ifdef _WIN32
+    HANDLE _file = INVALID_HANDLE_VALUE;
+    HANDLE _mapping = nullptr;
+#else
+    int _fd = -1;
+#endif
+    const std::byte* _data = nullptr;
+    size_t _size = 0;
+};
+
+// Directory of precomputed per-mesh data (acceleration structures and the like), so tools run one after
+// another on the same scan do not rebuild them. Entries are keyed by MeshHash and a kind string and hold
+// a list of raw byte sections. Every entry carries a checksum that is verified on load; entries that fail
+// it are deleted. The least recently used entries are evicted once the directory exceeds the size or
+// count limit.
+class MeshCache
+{
+public:
+    struct Entry
+    {
+        std::unique_ptr<MappedFile> _file;
+        std::vector<std::span<const std::byte>> _sections; // point into _file
+    };
+
+    MeshCache(std::filesystem::path dir, uint64_t max_bytes, size_t max_entries)
+        : _dir(std::move(dir)), _max_bytes(max_bytes), _max_entries(max_entries)
+    {
+        std::filesystem::create_directories(_dir);
+    }
+
+    // Cache configured by the environment: ORTHO_CACHE_DIR enables it, ORTHO_CACHE_MAX_MB (default 2048)
+    // and ORTHO_CACHE_MAX_ENTRIES (default 64) set the limits. Returns nullptr if caching is disabled.
+    static MeshCache* Default()
+    {
+        static std::unique_ptr<MeshCache> cache = []() -> std::unique_ptr<MeshCache> {
+            const char* dir = std::getenv("ORTHO_CACHE_DIR");
+            if(dir == nullptr || dir[0] == '\0')
+                return nullptr;
+            const char* max_mb = std::getenv("ORTHO_CACHE_MAX_MB");
+            const char* max_entries = std::getenv("ORTHO_CACHE_MAX_ENTRIES");
+            try
+            {
+                return std::make_unique<MeshCache>(dir,
+                    (max_mb ? std::strtoull(max_mb, nullptr, 10) : 2048ull) << 20,
+                    max_entries ? std::strtoull(max_entries, nullptr, 10) : 64);
+            }
+            catch(const std::filesystem::filesystem_error&)
+            {
+                return nullptr;
+            }
+        }();
+        return cache.get();
+    }
+
+    // Map the entry (key, kind). Returns nothing if it does not exist or is corrupted.
+    std::optional<Entry> Load(uint64_t key, const std::string& kind)
+    {
+        auto path = EntryPath(key, kind);
+        std::error_code ec;
+        if(!std::filesystem::exists(path, ec))
+            return std::nullopt;
+        Entry entry;
+        try
+        {
+            entry._file = std::make_unique<MappedFile>(path);
+        }
+        catch(const IOError&)
+        {
+            return std::nullopt;
+        }
+        if(!Parse(*entry._file, key, entry._sections))
+        {
+            entry._file.reset();
+            std::filesystem::remove(path, ec);
+            return std::nullopt;
+        }
+        // mark as recently used for eviction
+        std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), ec);
+        return entry;
+    }
+
+    // Write the entry (key, kind) and evict old entries if the limits are exceeded. Failures are ignored,
+    // the cache is only an optimization.
+    void Store(uint64_t key, const std::string& kind, const std::vector<std::span<const std::byte>>& sections)
+    {
+        auto path = EntryPath(key, kind);
+        auto tmp_path = path;
+        tmp_path += ".tmp" + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count());
+        {
+            std::ofstream ofs(tmp_path, std::ios::binary);
+            if(!ofs)
+                return;
+            Header header;
+            header._key = key;
+            header._nb_sections = static_cast<uint32_t>(sections.size());
+            std::vector<uint64_t> sizes;
+            internal::Fnv1a64 checksum;
+            for(auto& s : sections)
+            {
+                sizes.push_back(s.size());
+            }
+            checksum.Add(sizes.data(), sizes.size() * sizeof(uint64_t));
+            for(auto& s : sections)
+            {
+                checksum.Add(s.data(), s.size());
+            }
+            header._checksum = checksum.Value();
+            ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            ofs.write(reinterpret_cast<const char*>(sizes.data()), sizes.size() * sizeof(uint64_t));
+            for(auto& s : sections)
+            {
+                ofs.write(reinterpret_cast<const char*>(s.data()), s.size());
+                WritePadding(ofs, s.size());
+            }
+            if(!ofs)
+            {
+                ofs.close();
+                std::error_code ec;
+                std::filesystem::remove(tmp_path, ec);
+                return;
+            }
+        }
+        // rename is atomic, so other processes never map a half written entry.
+        std::error_code ec;
+        std::filesystem::rename(tmp_path, path, ec);
+        if(ec)
+        {
+            std::filesystem::remove(tmp_path, ec);
+            return;
+        }
+        Evict();
+    }
+
+protected:
+    static constexpr char kMagic[8] = { 'O', 'R', 'T', 'H', 'O', 'C', 'C', 'H' };
+    static constexpr uint32_t kVersion = 1;
+    static constexpr size_t kAlignment = 16;
+
+    struct Header
+    {
+        char _magic[8] = { 'O', 'R', 'T', 'H', 'O', 'C', 'C', 'H' };
+        uint32_t _version = kVersion;
+        uint32_t _nb_sections = 0;
+        uint64_t _key = 0;
+        uint64_t _checksum = 0; // of section sizes and contents
+    };
+
+    std::filesystem::path EntryPath(uint64_t key, const std::string& kind) const
+    {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(key));
+        return _dir / (std::string(name) + "-" + kind + ".cache");
+    }
+
+    // Sections start at kAlignment boundaries so they can be read in place as arrays.
+    static void WritePadding(std::ofstream& ofs, size_t size)
+    {
+        static const char zeros[kAlignment] = {};
+        ofs.write(zeros, (kAlignment - size % kAlignment) % kAlignment);
+    }
+
+    static bool Parse(const MappedFile& file, uint64_t key, std::vector<std::span<const std::byte>>& sections)
+    {
+        if(file.size() < sizeof(Header))
+            return false;
+        Header header;
+        std::memcpy(&header, file.data(), sizeof(Header));
+        if(std::memcmp(header._magic, kMagic, sizeof(kMagic)) != 0 || header._version != kVersion || header._key != key)
+            return false;
+        if(header._nb_sections > (file.size() - sizeof(Header)) / sizeof(uint64_t))
+            return false;
+        size_t offset = sizeof(Header) + header._nb_sections * sizeof(uint64_t);
+        std::vector<uint64_t> sizes(header._nb_sections);
+        std::memcpy(sizes.data(), file.data() + sizeof(Header), sizes.size() * sizeof(uint64_t));
+        internal::Fnv1a64 checksum;
+        checksum.Add(sizes.data(), sizes.size() * sizeof(uint64_t));
+        sections.clear();
+        for(uint64_t size : sizes)
+        {
+            // the padding of the previous section may run past the end of a truncated file.
+            if(offset > file.size() || size > file.size() - offset)
+                return false;
+            sections.emplace_back(file.data() + offset, size);
+            checksum.Add(file.data() + offset, size);
+            offset += size + (kAlignment - size % kAlignment) % kAlignment;
+        }
+        return checksum.Value() == header._checksum;
+    }
+
+    void Evict()
+    {
+        struct File
+        {
+            std::filesystem::path _path;
+            std::filesystem::file_time_type _time;
+            uint64_t _size;
+        };
+        std::vector<File> files;
+        uint64_t total = 0;
+        std::error_code ec;
+        for(auto& e : std::filesystem::directory_iterator(_dir, ec))
+        {
+            if(e.is_regular_file(ec) && e.path().extension() == ".cache")
+            {
+                files.push_back({ e.path(), e.last_write_time(ec), e.file_size(ec) });
+                total += files.back()._size;
+            }
+        }
+        std::sort(files.begin(), files.end(), [](const File& l, const File& r) { return l._time < r._time; });
+        size_t count = files.size();
+        for(auto& f : files)
+        {
+            if(total <= _max_bytes && count <= _max_entries)
+                break;
+            if(std::filesystem::remove(f._path, ec))
+            {
+                total -= f._size;
+                count--;
+            }
+        }
+    }
+
+    std::filesystem::path _dir;
+    uint64_t _max_bytes;
+    size_t _max_entries;
+};
+
+#endif
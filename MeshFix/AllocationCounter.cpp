@@ -0,0 +1,37 @@
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// Counts heap allocations for the per-stage numbers of FixMeshDiagnostics. Replacing the global operator new
+// affects the whole process, so only the MeshFix executable links this file, never the python module.
+#ifdef ORTHO_COUNT_ALLOCATIONS
+extern std::atomic<long long>* gAllocationCounter;
+
+namespace
+{
+std::atomic<long long> gAllocationCount = 0;
+
+struct RegisterCounter
+{
+    RegisterCounter() { gAllocationCounter = &gAllocationCount; }
+} gRegisterCounter;
+}
+
+void* operator new(std::size_t size)
+{
+    gAllocationCount.fetch_add(1, std::memory_order_relaxed);
+    if(void* p = std::malloc(size == 0 ? 1 : size))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+#endif
@@ -1,5 +1,6 @@
 #include <atomic>
 #include <cctype>
+#include <cstdlib>
 #include <fstream>
 #include <filesystem>
 #include <functional>
@@ -22,6 +23,14 @@
 #endif
 // TODO: remove this
 bool gVerbose = true;
+
+// Set by AllocationCounter.cpp, which only the MeshFix executable links.
+std::atomic<long long>* gAllocationCounter = nullptr;
+
+long long AllocationCount()
+{
+    return gAllocationCounter != nullptr ? gAllocationCounter->load(std::memory_order_relaxed) : -1;
+}
 namespace 
 {
 using KernelEpick = CGAL::Exact_predicates_inexact_constructions_kernel;
@@ -39,11 +48,17 @@ bool FixMeshFile(
     int max_hole_edges,
     float max_hole_diam,
     bool refine,
-    int max_retry)
+    int max_retry,
+    int nb_tiles,
+    FixMeshDiagnostics* diagnostics,
+    bool repair_soup)
 {
     std::vector<KernelEpick::Point_3> vertices;
     std::vector<Triangle> faces;
-    LoadVFAssimp<KernelEpick, Triangle::size_type>(input_mesh, vertices, faces);
+    {
+        internal::StageTimer timer(diagnostics, "load");
+        LoadVFAssimp<KernelEpick, Triangle::size_type>(input_mesh, vertices, faces);
+    }
     if(gVerbose)
     {
         printf("Load mesh: V = %zd, F = %zd\n", vertices.size(), faces.size());
@@ -51,8 +66,11 @@ bool FixMeshFile(
     Polyhedron result;
     FixMesh<Polyhedron>(vertices, faces, result, keep_largest_connected_component,
      large_cc_threshold, fix_self_intersection,
-      filter_small_holes, max_hole_edges, max_hole_diam, refine, max_retry);
-    result.WriteAssimp(output_mesh);
+      filter_small_holes, max_hole_edges, max_hole_diam, refine, max_retry, false, nullptr, nb_tiles, diagnostics, repair_soup);
+    {
+        internal::StageTimer timer(diagnostics, "write");
+        result.WriteAssimp(output_mesh);
+    }
     if(gVerbose)
     {
         printf("Output V = %zd, F = %zd.\n", result.size_of_vertices(), result.size_of_facets());
@@ -72,26 +90,36 @@ bool FixMeshFileWithLabel(
     int max_hole_edges,
     float max_hole_diam,
     bool refine,
-    int max_retry
+    int max_retry,
+    int nb_tiles,
+    FixMeshDiagnostics* diagnostics,
+    bool repair_soup
 )
 {
     std::vector<KernelEpick::Point_3> vertices;
     std::vector<Triangle> faces;
-    LoadVFAssimp<KernelEpick, Triangle::size_type>(input_mesh, vertices, faces);
-    std::vector<int> labels = LoadLabels(input_label);
+    std::vector<int> labels;
+    {
+        internal::StageTimer timer(diagnostics, "load");
+        LoadVFAssimp<KernelEpick, Triangle::size_type>(input_mesh, vertices, faces);
+        labels = LoadLabels(input_label);
+    }
     if(gVerbose)
     {
         printf("Load mesh: V = %zd, F = %zd\n", vertices.size(), faces.size());
     }
     Polyhedron m;
     FixMeshWithLabel<Polyhedron>(vertices, faces, labels, m, keep_largest_connected_component, large_cc_threshold,
-     fix_self_intersection, filter_small_holes, max_hole_edges, max_hole_diam, refine, max_retry);
+     fix_self_intersection, filter_small_holes, max_hole_edges, max_hole_diam, refine, max_retry, nullptr, nb_tiles, diagnostics, repair_soup);
     
-    m.WriteAssimp(output_mesh);
+    {
+        internal::StageTimer timer(diagnostics, "write");
+        m.WriteAssimp(output_mesh);
+        m.WriteLabels(output_label, input_label);
+    }
     if(gVerbose)
     {
         printf("Output V = %zd, F = %zd.\n", m.size_of_vertices(), m.size_of_facets());
     }
-    m.WriteLabels(output_label, input_label);
     return true;
 }
\ No newline at end of file
@@ -1,10 +1,20 @@
 #ifndef MESH_FIX_H
 #define MESH_FIX_H
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <queue>
 #include <string>
+#include <tuple>
 #include <vector>
 #include <unordered_map>
 #include "../Polyhedron.h"
+#include <CGAL/Polygon_mesh_processing/bbox.h>
 #include <CGAL/Polygon_mesh_processing/border.h>
+#include <CGAL/Polygon_mesh_processing/polygon_soup_to_polygon_mesh.h>
 #include <CGAL/Polygon_mesh_processing/triangulate_hole.h>
 #include <CGAL/Polygon_mesh_processing/repair.h>
 #include <CGAL/Polygon_mesh_processing/self_intersections.h>
@@ -15,11 +25,104 @@
 #include <CGAL/IO/Color.h>
 #include <CGAL/Polyhedron_incremental_builder_3.h>
 #include <CGAL/Polyhedron_items_with_id_3.h>
+#include "../Components.h"
+#include "../LabelTransfer.h"
+#include "../Profiler.h"
 #include "../print.h"
 
 extern bool gVerbose;
+
+// Number of heap allocations made by the process so far, or -1 if it does not count them. Only the MeshFix
+// executable built with ORTHO_COUNT_ALLOCATIONS counts them (see AllocationCounter.cpp).
+long long AllocationCount();
+
+// What FixMesh/FixMeshWithLabel found and did, with the wall time and allocation count of each stage.
+struct FixMeshDiagnostics
+{
+    struct Stage
+    {
+        std::string _name;
+        double _seconds = 0.0;
+        long long _allocations = -1;
+    };
+
+    // found in the first pass over the input soup; the retries and the self-intersection fixes are not counted.
+    size_t _nb_nm_edges = 0;
+    size_t _nb_nm_vertices = 0;
+    int _nb_nm_retry = 0;
+    size_t _nb_self_intersecting_pairs = 0;
+    size_t _nb_removed_components = 0;
+    size_t _nb_holes = 0;
+    size_t _nb_holes_triangulated = 0;
+    size_t _nb_holes_refined = 0;
+    size_t _nb_holes_refined_faired = 0;
+    std::vector<Stage> _stages;
+
+    nlohmann::json ToJson() const
+    {
+        nlohmann::json j;
+        j["non_manifold_edges"] = _nb_nm_edges;
+        j["non_manifold_vertices"] = _nb_nm_vertices;
+        j["non_manifold_retry"] = _nb_nm_retry;
+        j["self_intersecting_pairs"] = _nb_self_intersecting_pairs;
+        j["removed_components"] = _nb_removed_components;
+        j["holes"]["found"] = _nb_holes;
+        j["holes"]["triangulated"] = _nb_holes_triangulated;
+        j["holes"]["refined"] = _nb_holes_refined;
+        j["holes"]["refined_faired"] = _nb_holes_refined_faired;
+        double total = 0.0;
+        j["stages"] = nlohmann::json::array();
+        for(const auto& stage : _stages)
+        {
+            nlohmann::json js;
+            js["name"] = stage._name;
+            js["seconds"] = stage._seconds;
+            if(stage._allocations >= 0)
+                js["allocations"] = stage._allocations;
+            j["stages"].push_back(js);
+            total += stage._seconds;
+        }
+        j["seconds"] = total;
+        return j;
+    }
+};
+
 namespace internal
 {
+// Records the duration of a scope as one stage of the diagnostics, and as a profiler scope when profiling.
+// Diagnostics may be null.
+class StageTimer
+{
+public:
+    StageTimer(FixMeshDiagnostics* diagnostics, std::string name)
+        : _diagnostics(diagnostics), _name(std::move(name)), _scope(_name)
+    {
+        if(_diagnostics != nullptr)
+        {
+            _allocations = AllocationCount();
+            _start = std::chrono::steady_clock::now();
+        }
+    }
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+    ~StageTimer()
+    {
+        if(_diagnostics != nullptr)
+        {
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - _start).count();
+            long long allocations = _allocations < 0 ? -1 : AllocationCount() - _allocations;
+            _diagnostics->_stages.push_back({_name, seconds, allocations});
+        }
+    }
+
+protected:
+    FixMeshDiagnostics* _diagnostics;
+    std::string _name;
+    Profiler::Scope _scope;
+    long long _allocations = -1;
+    std::chrono::steady_clock::time_point _start;
+};
+
 template <typename Kernel, typename SizeType>
 std::vector<TTriangle<SizeType>> FixRoundingOrder(const std::vector<typename Kernel::Point_3>& vertices, const std::vector<TTriangle<SizeType>>& faces )
 {
@@ -61,60 +164,213 @@ std::vector<TTriangle<SizeType>> FixRoundingOrder(const std::vector<typename Ker
     return new_faces;
 }
 
-template <typename Poly>
-#if BOOST_CXX_VERSION >= 202002L
-    requires std::derived_from<typename Poly::Items, ItemsWithLabelFlag>
-#endif
-void FixSelfIntersection( Poly& m, int max_retry )
+template <typename Kernel, typename SizeType>
+std::vector<TTriangle<SizeType>> RepairSoup(const std::vector<typename Kernel::Point_3>& vertices, const std::vector<TTriangle<SizeType>>& faces)
 {
-    static_assert(std::is_base_of_v<ItemsWithLabelFlag, typename Poly::Items>);
-    std::vector<std::pair<typename Poly::Facet_handle, typename Poly::Facet_handle>> intersect_faces;
-    CGAL::Polygon_mesh_processing::self_intersections<CGAL::Parallel_if_available_tag>(m, std::back_inserter(intersect_faces));
-    std::unordered_set<typename Poly::Facet_handle> face_to_remove;
-    for(auto [f1, f2] : intersect_faces)
+    // drop faces with bad or repeated indices, and faces with zero area.
+    std::vector<char> keep(faces.size(), 1);
+#pragma omp parallel for
+    for(int i = 0; i < faces.size(); i++)
     {
-        face_to_remove.insert(f1);  
-        face_to_remove.insert(f2);
+        const auto& f = faces[i];
+        if(f[0] >= vertices.size() || f[1] >= vertices.size() || f[2] >= vertices.size() || f[0] == f[1] || f[1] == f[2] || f[2] == f[0])
+        {
+            keep[i] = 0;
+        }
+        else if(CGAL::collinear(vertices[f[0]], vertices[f[1]], vertices[f[2]]))
+        {
+            keep[i] = 0;
+        }
     }
-    for(auto& hf : face_to_remove)
+    size_t nb_degenerate = std::count(keep.begin(), keep.end(), 0);
+
+    // drop duplicate faces, keeping the first one.
+    std::vector<SizeType> alive;
+    for(SizeType i = 0; i < faces.size(); i++)
     {
-        m.erase_facet(hf->halfedge());
+        if(keep[i])
+        {
+            alive.push_back(i);
+        }
+    }
+    std::vector<std::array<SizeType, 4>> keys(alive.size());
+#pragma omp parallel for
+    for(int i = 0; i < alive.size(); i++)
+    {
+        const auto& f = faces[alive[i]];
+        std::array<SizeType, 3> sorted{f[0], f[1], f[2]};
+        std::sort(sorted.begin(), sorted.end());
+        keys[i] = {sorted[0], sorted[1], sorted[2], alive[i]};
     }
+    std::sort(keys.begin(), keys.end());
+    size_t nb_duplicate = 0;
+    for(size_t i = 1; i < keys.size(); i++)
+    {
+        if(keys[i][0] == keys[i - 1][0] && keys[i][1] == keys[i - 1][1] && keys[i][2] == keys[i - 1][2])
+        {
+            keep[keys[i][3]] = 0;
+            nb_duplicate++;
+        }
+    }
+    alive.erase(std::remove_if(alive.begin(), alive.end(), [&](SizeType i) { return keep[i] == 0; }), alive.end());
 
-    auto [vertices, triangles] = m.ToVerticesTriangles();
-    std::vector<int> labels;
-    for(auto hv : CGAL::vertices(m))
+    // make orientation consistent across manifold edges.
+    struct EdgeRecord
     {
-        labels.push_back(hv->_label);
+        SizeType v0;
+        SizeType v1;
+        SizeType face;
+        bool forward;
+        bool operator<(const EdgeRecord& rh) const
+        {
+            return std::tie(v0, v1, face) < std::tie(rh.v0, rh.v1, rh.face);
+        }
+    };
+    std::vector<EdgeRecord> records(alive.size() * 3);
+#pragma omp parallel for
+    for(int i = 0; i < alive.size(); i++)
+    {
+        const auto& f = faces[alive[i]];
+        for(int j = 0; j < 3; j++)
+        {
+            SizeType a = f[j];
+            SizeType b = f[(j + 1) % 3];
+            records[i * 3 + j] = EdgeRecord{std::min(a, b), std::max(a, b), alive[i], a < b};
+        }
     }
-    size_t nb_removed_faces = 0;
-    int cnt = 0;
-    do
+    std::sort(records.begin(), records.end());
+
+    constexpr SizeType NO_FACE = std::numeric_limits<SizeType>::max();
+    // neighbors[f * 3 + k] = (neighbor face, whether both faces walk the shared edge in the same direction)
+    std::vector<std::pair<SizeType, bool>> neighbors(faces.size() * 3, {NO_FACE, false});
+    std::vector<uint8_t> nb_neighbors(faces.size(), 0);
+    for(size_t i = 0; i < records.size();)
     {
-        triangles = RemoveNonManifold<typename Poly::Vertex::Point_3::R, typename Poly::Face::size_type>(vertices, triangles, &nb_removed_faces);
-        if(cnt++ > max_retry)
-            break;
-    } while(nb_removed_faces != 0);
-    
-    try
+        size_t j = i + 1;
+        while(j < records.size() && records[j].v0 == records[i].v0 && records[j].v1 == records[i].v1)
+        {
+            j++;
+        }
+        if(j - i == 2)
+        {
+            const auto& r0 = records[i];
+            const auto& r1 = records[i + 1];
+            bool same_dir = r0.forward == r1.forward;
+            neighbors[r0.face * 3 + nb_neighbors[r0.face]++] = {r1.face, same_dir};
+            neighbors[r1.face * 3 + nb_neighbors[r1.face]++] = {r0.face, same_dir};
+        }
+        i = j;
+    }
+
+    std::vector<int8_t> flip(faces.size(), -1);
+    size_t nb_flipped = 0;
+    for(SizeType start : alive)
     {
-        m.BuildFromVerticesFaces(vertices, triangles);
+        if(flip[start] != -1)
+        {
+            continue;
+        }
+        std::vector<SizeType> component;
+        std::queue<SizeType> q;
+        q.push(start);
+        flip[start] = 0;
+        size_t nb_component_flipped = 0;
+        while(!q.empty())
+        {
+            SizeType f = q.front();
+            q.pop();
+            component.push_back(f);
+            for(uint8_t k = 0; k < nb_neighbors[f]; k++)
+            {
+                auto [g, same_dir] = neighbors[f * 3 + k];
+                if(flip[g] != -1)
+                {
+                    continue;
+                }
+                flip[g] = same_dir ? 1 - flip[f] : flip[f];
+                nb_component_flipped += flip[g];
+                q.push(g);
+            }
+        }
+        // keep the orientation of the majority.
+        if(nb_component_flipped * 2 > component.size())
+        {
+            for(SizeType f : component)
+            {
+                flip[f] = 1 - flip[f];
+            }
+            nb_component_flipped = component.size() - nb_component_flipped;
+        }
+        nb_flipped += nb_component_flipped;
     }
-    catch(const MeshError& e)
+
+    std::vector<TTriangle<SizeType>> result;
+    result.reserve(alive.size());
+    for(SizeType i : alive)
     {
-        throw AlgError("Failed to fix self intersection: " + std::string(e.what()));
+        const auto& f = faces[i];
+        if(flip[i] == 1)
+        {
+            result.emplace_back(f[0], f[2], f[1]);
+        }
+        else
+        {
+            result.push_back(f);
+        }
     }
-    
-    auto hv = m.vertices_begin();
-    for(size_t i = 0; i < vertices.size(); i++)
+    if(gVerbose)
     {
-        hv->_label = labels[i];
-        hv++;
+        std::cout << "Repair soup: remove " << nb_degenerate << " degenerate and " << nb_duplicate << " duplicate faces, flip " << nb_flipped << " faces." << std::endl;
+    }
+    return result;
+}
+
+// Number of edge-connected clusters formed by the faces around one vertex. More than one means the vertex is non-manifold.
+template <typename SizeType>
+size_t CountFaceClusters(const std::vector<TTriangle<SizeType>>& faces, const std::vector<SizeType>& neighbors)
+{
+    size_t nb_connect_faces = neighbors.size();
+    std::vector<int> sampled(nb_connect_faces, 0);
+    size_t nb_cluster = 0;
+    for(size_t i = 0; i < nb_connect_faces; i++)
+    {
+        if(sampled[i] == 1)
+            continue;
+        std::list<size_t> cluster;
+        cluster.push_back(i);
+        sampled[i] = 1;
+        do
+        {
+            auto e0 = faces[neighbors[cluster.front()]].GetEdge(0);
+            auto e1 = faces[neighbors[cluster.front()]].GetEdge(1);
+            auto e2 = faces[neighbors[cluster.front()]].GetEdge(2);
+
+            for(size_t j = 0; j < nb_connect_faces; j++)
+            {
+                if(j != cluster.front() && sampled[j] != 1)
+                {
+                    auto e3 = faces[neighbors[j]].GetEdge(0);
+                    auto e4 = faces[neighbors[j]].GetEdge(1);
+                    auto e5 = faces[neighbors[j]].GetEdge(2);
+
+                    if(TPairPredUnordered<SizeType>()(e0, e3) || TPairPredUnordered<SizeType>()(e0, e4) || TPairPredUnordered<SizeType>()(e0, e5) ||
+                    TPairPredUnordered<SizeType>()(e1, e3) || TPairPredUnordered<SizeType>()(e1, e4) || TPairPredUnordered<SizeType>()(e1, e5) ||
+                    TPairPredUnordered<SizeType>()(e2, e3) || TPairPredUnordered<SizeType>()(e2, e4) || TPairPredUnordered<SizeType>()(e2, e5))
+                    {
+                        cluster.push_back(j);
+                        sampled[j] = 1;
+                    }
+                }
+            }
+            cluster.pop_front();
+        } while(!cluster.empty());
+        nb_cluster++;
     }
+    return nb_cluster;
 }
 
 template <typename Kernel, typename SizeType>
-std::vector<TTriangle<SizeType>> RemoveNonManifold(const std::vector<typename Kernel::Point_3>& vertices, const std::vector<TTriangle<SizeType>>& faces, size_t* nb_removed_face)
+std::vector<TTriangle<SizeType>> RemoveNonManifold(const std::vector<typename Kernel::Point_3>& vertices, const std::vector<TTriangle<SizeType>>& faces, size_t* nb_removed_face, FixMeshDiagnostics* diagnostics = nullptr)
 {
     using size_type = SizeType;
     std::vector<std::pair<TTriangle<SizeType>, bool>> faceflags;
@@ -205,45 +461,7 @@ std::vector<TTriangle<SizeType>> RemoveNonManifold(const std::vector<typename Ke
     for(int iv = 0; iv < vneighbors.size(); iv++)
     {
         auto& neighbors = vneighbors[iv];
-        std::list<std::pair<SizeType, SizeType>> sur_edges;
-        size_t nb_connect_faces = neighbors.size();
-        std::vector<int> sampled(nb_connect_faces, 0);
-        size_t nb_cluster = 0;
-        for(size_t i = 0; i < nb_connect_faces; i++)
-        {
-            if(sampled[i] == 1)
-                continue;
-            std::list<size_t> cluster;
-            cluster.push_back(i);
-            sampled[i] = 1;
-            do
-            {
-                auto e0 = faceflags[neighbors[cluster.front()]].first.GetEdge(0);
-                auto e1 = faceflags[neighbors[cluster.front()]].first.GetEdge(1);
-                auto e2 = faceflags[neighbors[cluster.front()]].first.GetEdge(2);
-
-                for(size_t j = 0; j < nb_connect_faces; j++)
-                {
-                    if(j != cluster.front() && sampled[j] != 1)
-                    {
-                        auto e3 = faceflags[neighbors[j]].first.GetEdge(0);
-                        auto e4 = faceflags[neighbors[j]].first.GetEdge(1);
-                        auto e5 = faceflags[neighbors[j]].first.GetEdge(2);
-
-                        if(TPairPredUnordered<SizeType>()(e0, e3) || TPairPredUnordered<SizeType>()(e0, e4) || TPairPredUnordered<SizeType>()(e0, e5) ||
-                        TPairPredUnordered<SizeType>()(e1, e3) || TPairPredUnordered<SizeType>()(e1, e4) || TPairPredUnordered<SizeType>()(e1, e5) ||
-                        TPairPredUnordered<SizeType>()(e2, e3) || TPairPredUnordered<SizeType>()(e2, e4) || TPairPredUnordered<SizeType>()(e2, e5))
-                        {
-                            cluster.push_back(j);
-                            sampled[j] = 1;
-                        }
-                    }
-                }
-                cluster.pop_front();
-            } while(!cluster.empty());
-            nb_cluster++;
-        }
-
+        size_t nb_cluster = CountFaceClusters(faces, neighbors);
         if(nb_cluster > 1)
         {
             nb_nm_vertices++;
@@ -268,9 +486,308 @@ std::vector<TTriangle<SizeType>> RemoveNonManifold(const std::vector<typename Ke
         std::cout << "Find " << nb_nm_edges << " non-manifold edges and " << nb_nm_vertices << " non-manifold vertices." << std::endl;
         std::cout << "After remove non-manifold: " << result_faces.size() << " faces." << std::endl;
     }
+    if(diagnostics != nullptr)
+    {
+        diagnostics->_nb_nm_edges = nb_nm_edges;
+        diagnostics->_nb_nm_vertices = nb_nm_vertices;
+    }
     *nb_removed_face = faces.size() - result_faces.size();
     return result_faces;
 }
+// Regular grid over a bounding box, splitting it into about nb_tiles cells.
+struct TileGrid
+{
+    TileGrid(const CGAL::Bbox_3& bbox, int nb_tiles)
+        : _bbox(bbox), _n(std::max(1, static_cast<int>(std::ceil(std::cbrt(static_cast<double>(nb_tiles)))))) {}
+
+    int Size() const { return _n * _n * _n; }
+
+    int Coord(double v, int axis) const
+    {
+        double len = _bbox.max(axis) - _bbox.min(axis);
+        if(len <= 0.0)
+            return 0;
+        return std::clamp(static_cast<int>((v - _bbox.min(axis)) / len * _n), 0, _n - 1);
+    }
+
+    int Cell(int x, int y, int z) const { return (z * _n + y) * _n + x; }
+
+    template <typename Point>
+    int CellOf(const Point& p) const { return Cell(Coord(p.x(), 0), Coord(p.y(), 1), Coord(p.z(), 2)); }
+
+    // All cells overlapped by a box. Two overlapping boxes always share at least one cell.
+    template <typename OutputIterator>
+    void CellsOf(const CGAL::Bbox_3& box, OutputIterator out) const
+    {
+        for(int z = Coord(box.zmin(), 2); z <= Coord(box.zmax(), 2); z++)
+            for(int y = Coord(box.ymin(), 1); y <= Coord(box.ymax(), 1); y++)
+                for(int x = Coord(box.xmin(), 0); x <= Coord(box.xmax(), 0); x++)
+                    *out++ = Cell(x, y, z);
+    }
+
+    CGAL::Bbox_3 _bbox;
+    int _n = 1;
+};
+
+// Same result as RemoveNonManifold, but the soup is split into spatial tiles that are processed in parallel.
+// A tile owns the vertices in its grid cell and reads every face around them, so faces crossing a seam are
+// seen by all the tiles they touch. An edge is decided by the tile owning its smaller vertex, a vertex by
+// its own tile, and the per-tile decisions are merged before the second pass.
+template <typename Kernel, typename SizeType>
+std::vector<TTriangle<SizeType>> RemoveNonManifoldTiled(const std::vector<typename Kernel::Point_3>& vertices, const std::vector<TTriangle<SizeType>>& faces, size_t* nb_removed_face, int nb_tiles, FixMeshDiagnostics* diagnostics = nullptr)
+{
+    const size_t nb_vertices = vertices.size();
+    const size_t nb_faces = faces.size();
+
+    // vertex -> faces, in CSR form. Faces of a vertex are sorted by index.
+    std::vector<size_t> vf_offsets(nb_vertices + 1, 0);
+    for(const auto& f : faces)
+    {
+        vf_offsets[f[0] + 1]++;
+        vf_offsets[f[1] + 1]++;
+        vf_offsets[f[2] + 1]++;
+    }
+    std::partial_sum(vf_offsets.begin(), vf_offsets.end(), vf_offsets.begin());
+    std::vector<SizeType> vf(vf_offsets.back());
+    {
+        std::vector<size_t> fill(vf_offsets.begin(), vf_offsets.end() - 1);
+        for(size_t i = 0; i < nb_faces; i++)
+        {
+            vf[fill[faces[i][0]]++] = i;
+            vf[fill[faces[i][1]]++] = i;
+            vf[fill[faces[i][2]]++] = i;
+        }
+    }
+
+    TileGrid grid(CGAL::bbox_3(vertices.begin(), vertices.end()), nb_tiles);
+    std::vector<std::vector<SizeType>> tile_vertices(grid.Size());
+    for(size_t v = 0; v < nb_vertices; v++)
+    {
+        if(vf_offsets[v] != vf_offsets[v + 1])
+        {
+            tile_vertices[grid.CellOf(vertices[v])].push_back(v);
+        }
+    }
+    tile_vertices.erase(std::remove_if(tile_vertices.begin(), tile_vertices.end(), [](const auto& t) { return t.empty(); }), tile_vertices.end());
+    const int nb_tile = static_cast<int>(tile_vertices.size());
+
+    // pass 1: faces on edges shared by more than two faces.
+    std::vector<std::vector<SizeType>> tile_removed(nb_tile);
+    std::vector<std::vector<SizeType>> tile_problematic(nb_tile);
+    std::vector<size_t> tile_nm_edges(nb_tile, 0);
+#pragma omp parallel for schedule(dynamic)
+    for(int t = 0; t < nb_tile; t++)
+    {
+        std::unordered_map<SizeType, std::vector<SizeType>> edge_faces;
+        for(SizeType v : tile_vertices[t])
+        {
+            edge_faces.clear();
+            for(size_t j = vf_offsets[v]; j < vf_offsets[v + 1]; j++)
+            {
+                if(j != vf_offsets[v] && vf[j] == vf[j - 1])
+                    continue;
+                const auto& f = faces[vf[j]];
+                for(int k = 0; k < 3; k++)
+                {
+                    SizeType a = f[k];
+                    SizeType b = f[(k + 1) % 3];
+                    if(std::min(a, b) == v)
+                    {
+                        edge_faces[std::max(a, b)].push_back(vf[j]);
+                    }
+                }
+            }
+            for(const auto& [other, efaces] : edge_faces)
+            {
+                if(efaces.size() <= 2)
+                    continue;
+                tile_problematic[t].push_back(v);
+                tile_problematic[t].push_back(other);
+                tile_nm_edges[t] += efaces.size();
+                tile_removed[t].insert(tile_removed[t].end(), efaces.begin(), efaces.end());
+            }
+        }
+    }
+
+    std::vector<char> nm_edge_face(nb_faces, 0);
+    std::vector<char> problematic(nb_vertices, 0);
+    size_t nb_nm_edges = 0;
+    for(int t = 0; t < nb_tile; t++)
+    {
+        for(auto f : tile_removed[t])
+            nm_edge_face[f] = 1;
+        for(auto v : tile_problematic[t])
+            problematic[v] = 1;
+        nb_nm_edges += tile_nm_edges[t];
+    }
+
+    // pass 2: faces around problematic vertices and around vertices whose faces form several clusters.
+    std::vector<std::vector<SizeType>> tile_removed2(nb_tile);
+    std::vector<size_t> tile_nm_vertices(nb_tile, 0);
+#pragma omp parallel for schedule(dynamic)
+    for(int t = 0; t < nb_tile; t++)
+    {
+        std::vector<SizeType> neighbors;
+        for(SizeType v : tile_vertices[t])
+        {
+            neighbors.clear();
+            for(size_t j = vf_offsets[v]; j < vf_offsets[v + 1]; j++)
+            {
+                if(!nm_edge_face[vf[j]])
+                    neighbors.push_back(vf[j]);
+            }
+            bool nm_vertex = CountFaceClusters(faces, neighbors) > 1;
+            if(nm_vertex)
+                tile_nm_vertices[t]++;
+            if(nm_vertex || problematic[v])
+                tile_removed2[t].insert(tile_removed2[t].end(), neighbors.begin(), neighbors.end());
+        }
+    }
+
+    size_t nb_nm_vertices = 0;
+    for(int t = 0; t < nb_tile; t++)
+    {
+        for(auto f : tile_removed2[t])
+            nm_edge_face[f] = 1;
+        nb_nm_vertices += tile_nm_vertices[t];
+    }
+
+    std::vector<TTriangle<SizeType>> result_faces;
+    for(size_t i = 0; i < nb_faces; i++)
+    {
+        if(!nm_edge_face[i])
+        {
+            result_faces.push_back(faces[i]);
+        }
+    }
+
+    if(gVerbose)
+    {
+        std::cout << "Find " << nb_nm_edges << " non-manifold edges and " << nb_nm_vertices << " non-manifold vertices in " << nb_tile << " tiles." << std::endl;
+        std::cout << "After remove non-manifold: " << result_faces.size() << " faces." << std::endl;
+    }
+    if(diagnostics != nullptr)
+    {
+        diagnostics->_nb_nm_edges = nb_nm_edges;
+        diagnostics->_nb_nm_vertices = nb_nm_vertices;
+    }
+    *nb_removed_face = faces.size() - result_faces.size();
+    return result_faces;
+}
+
+// Dispatch between the global and the tiled non-manifold removal.
+template <typename Kernel, typename SizeType>
+std::vector<TTriangle<SizeType>> RemoveNonManifold(const std::vector<typename Kernel::Point_3>& vertices, const std::vector<TTriangle<SizeType>>& faces, size_t* nb_removed_face, int nb_tiles, FixMeshDiagnostics* diagnostics)
+{
+    if(nb_tiles > 1)
+    {
+        return RemoveNonManifoldTiled<Kernel, SizeType>(vertices, faces, nb_removed_face, nb_tiles, diagnostics);
+    }
+    return RemoveNonManifold<Kernel, SizeType>(vertices, faces, nb_removed_face, diagnostics);
+}
+template <typename Poly>
+#if BOOST_CXX_VERSION >= 202002L
+    requires std::derived_from<typename Poly::Items, ItemsWithLabelFlag>
+#endif
+void FixSelfIntersection( Poly& m, int max_retry, int nb_tiles = 0, FixMeshDiagnostics* diagnostics = nullptr )
+{
+    static_assert(std::is_base_of_v<ItemsWithLabelFlag, typename Poly::Items>);
+    std::vector<std::pair<typename Poly::Facet_handle, typename Poly::Facet_handle>> intersect_faces;
+    if(nb_tiles > 1)
+    {
+        // each tile tests the faces whose bounding box overlaps it. Intersecting faces have overlapping
+        // boxes, so every pair is found by at least one tile.
+        TileGrid grid(CGAL::Polygon_mesh_processing::bbox(m), nb_tiles);
+        std::vector<std::vector<typename Poly::Facet_handle>> tile_faces(grid.Size());
+        std::vector<int> cells;
+        for(auto hf : CGAL::faces(m))
+        {
+            auto hh = hf->halfedge();
+            CGAL::Bbox_3 box = hh->vertex()->point().bbox() + hh->next()->vertex()->point().bbox() + hh->prev()->vertex()->point().bbox();
+            cells.clear();
+            grid.CellsOf(box, std::back_inserter(cells));
+            for(int c : cells)
+                tile_faces[c].push_back(hf);
+        }
+        tile_faces.erase(std::remove_if(tile_faces.begin(), tile_faces.end(), [](const auto& t) { return t.empty(); }), tile_faces.end());
+        std::vector<std::vector<std::pair<typename Poly::Facet_handle, typename Poly::Facet_handle>>> tile_pairs(tile_faces.size());
+#pragma omp parallel for schedule(dynamic)
+        for(int t = 0; t < tile_faces.size(); t++)
+        {
+            CGAL::Polygon_mesh_processing::self_intersections(tile_faces[t], m, std::back_inserter(tile_pairs[t]));
+        }
+        for(auto& pairs : tile_pairs)
+        {
+            intersect_faces.insert(intersect_faces.end(), pairs.begin(), pairs.end());
+        }
+    }
+    else
+    {
+        CGAL::Polygon_mesh_processing::self_intersections<CGAL::Parallel_if_available_tag>(m, std::back_inserter(intersect_faces));
+    }
+    if(diagnostics != nullptr)
+    {
+        diagnostics->_nb_self_intersecting_pairs += intersect_faces.size();
+    }
+    std::unordered_set<typename Poly::Facet_handle> face_to_remove;
+    for(auto [f1, f2] : intersect_faces)
+    {
+        face_to_remove.insert(f1);  
+        face_to_remove.insert(f2);
+    }
+    for(auto& hf : face_to_remove)
+    {
+        m.erase_facet(hf->halfedge());
+    }
+
+    auto [vertices, triangles] = m.ToVerticesTriangles();
+    std::vector<int> labels;
+    for(auto hv : CGAL::vertices(m))
+    {
+        labels.push_back(hv->_label);
+    }
+    size_t nb_removed_faces = 0;
+    int cnt = 0;
+    do
+    {
+        triangles = RemoveNonManifold<typename Poly::Vertex::Point_3::R, typename Poly::Face::size_type>(vertices, triangles, &nb_removed_faces, nb_tiles, nullptr);
+        if(cnt++ > max_retry)
+            break;
+    } while(nb_removed_faces != 0);
+    
+    try
+    {
+        m.BuildFromVerticesFaces(vertices, triangles);
+    }
+    catch(const MeshError& e)
+    {
+        throw AlgError("Failed to fix self intersection: " + std::string(e.what()));
+    }
+    
+    auto hv = m.vertices_begin();
+    for(size_t i = 0; i < vertices.size(); i++)
+    {
+        hv->_label = labels[i];
+        hv++;
+    }
+}
+// Erase the edge-connected components with fewer than threshold faces. Returns the number of erased components.
+template <typename Poly>
+size_t RemoveSmallComponents( Poly& m, size_t threshold )
+{
+    CGAL::set_halfedgeds_items_id(m);
+    const std::vector<typename Poly::Facet_handle> faces(m.facets_begin(), m.facets_end());
+    ComponentLabeling components = FaceComponents(m, [](auto f0, auto f1) { return true; });
+    size_t nb_removed = std::count_if(components._sizes.begin(), components._sizes.end(), [&](size_t size) { return size < threshold; });
+    for(size_t i = 0; i < faces.size(); i++)
+    {
+        if(components._sizes[components._ids[i]] < threshold)
+        {
+            m.erase_facet(faces[i]->halfedge());
+        }
+    }
+    return nb_removed;
+}
 }
 
 bool FixMeshFile(
@@ -283,7 +800,10 @@ bool FixMeshFile(
     int max_hole_edges,
     float max_hole_diam,
     bool refine,
-    int max_retry);
+    int max_retry,
+    int nb_tiles = 0,
+    FixMeshDiagnostics* diagnostics = nullptr,
+    bool repair_soup = false);
 
 bool FixMeshFileWithLabel(
     std::string input_mesh,
@@ -297,7 +817,10 @@ bool FixMeshFileWithLabel(
     int max_hole_edges,
     float max_hole_diam,
     bool refine,
-    int max_retry);
+    int max_retry,
+    int nb_tiles = 0,
+    FixMeshDiagnostics* diagnostics = nullptr,
+    bool repair_soup = false);
 
 template <typename Polyhedron>
 void FixMesh(
@@ -313,22 +836,41 @@ void FixMesh(
     bool refine,
     int max_retry,
     bool fair = false,
-    std::vector<std::pair<std::vector<typename Polyhedron::Vertex_handle>, std::vector<typename Polyhedron::Facet_handle>>>* patch = nullptr
+    std::vector<std::pair<std::vector<typename Polyhedron::Vertex_handle>, std::vector<typename Polyhedron::Facet_handle>>>* patch = nullptr,
+    int nb_tiles = 0,
+    FixMeshDiagnostics* diagnostics = nullptr,
+    bool repair_soup = false
 )
 {
     using Kernel = typename Polyhedron::K;
     using Triangle = TTriangle<typename Polyhedron::Vertex::size_type>;
-    auto faces = internal::FixRoundingOrder<Kernel, typename Triangle::size_type>(input_vertices, input_faces);
+    std::vector<Triangle> faces = input_faces;
+    if(repair_soup)
+    {
+        internal::StageTimer timer(diagnostics, "repair_soup");
+        faces = internal::RepairSoup<Kernel, typename Triangle::size_type>(input_vertices, input_faces);
+    }
+    {
+        internal::StageTimer timer(diagnostics, "fix_rounding");
+        faces = internal::FixRoundingOrder<Kernel, typename Triangle::size_type>(input_vertices, faces);
+    }
     std::cout << "After fix rounding F = " << faces.size() << std::endl;
 
     size_t nb_removed_faces = 0;
     int cnt = 0;
-    do
     {
-        faces = internal::RemoveNonManifold<Kernel, typename Triangle::size_type>(input_vertices, faces, &nb_removed_faces);
-        if(cnt++ >= max_retry)
-            break;
-    } while (nb_removed_faces != 0);
+        internal::StageTimer timer(diagnostics, "remove_non_manifold");
+        do
+        {
+            faces = internal::RemoveNonManifold<Kernel, typename Triangle::size_type>(input_vertices, faces, &nb_removed_faces, nb_tiles, cnt == 0 ? diagnostics : nullptr);
+            if(cnt++ >= max_retry)
+                break;
+        } while (nb_removed_faces != 0);
+    }
+    if(diagnostics != nullptr)
+    {
+        diagnostics->_nb_nm_retry = cnt;
+    }
     if(cnt >= max_retry)
     {
         throw AlgError("Cannot remove non-manifold parts. Try increasing retry times.");
@@ -336,26 +878,39 @@ void FixMesh(
 
     Polyhedron& m = output_mesh;
     m.clear();
-    m.BuildFromVerticesFaces(input_vertices, faces);
-    
-    CGAL::Polygon_mesh_processing::remove_isolated_vertices(m);
+    {
+        internal::StageTimer timer(diagnostics, "build");
+        m.BuildFromVerticesFaces(input_vertices, faces);
+        CGAL::Polygon_mesh_processing::remove_isolated_vertices(m);
+    }
 
     if(fix_self_intersection)
     {
-        internal::FixSelfIntersection(m, max_retry);
+        internal::StageTimer timer(diagnostics, "self_intersection");
+        internal::FixSelfIntersection(m, max_retry, nb_tiles, diagnostics);
     }
 
     if(keep_largest_connected_component)
     {
-        size_t num = CGAL::Polygon_mesh_processing::keep_large_connected_components(m, large_cc_threshold);
+        internal::StageTimer timer(diagnostics, "connected_components");
+        size_t num = internal::RemoveSmallComponents(m, large_cc_threshold);
         if(gVerbose)
         {
             std::cout << "Remove " << num << " small connected components." << std::endl;
         }
+        if(diagnostics != nullptr)
+        {
+            diagnostics->_nb_removed_components = num;
+        }
     }
 
+    internal::StageTimer timer(diagnostics, "fill_holes");
     std::vector<typename Polyhedron::Halfedge_handle> border_edges;
     CGAL::Polygon_mesh_processing::extract_boundary_cycles(m, std::back_inserter(border_edges));
+    if(diagnostics != nullptr)
+    {
+        diagnostics->_nb_holes = border_edges.size();
+    }
     for(typename Polyhedron::Halfedge_handle hh : border_edges)
     {
         if(!filter_small_holes || (filter_small_holes && m.IsSmallHole(hh, max_hole_edges, max_hole_diam)))
@@ -365,6 +920,10 @@ void FixMesh(
                 std::vector<typename Polyhedron::Vertex_handle> patch_vertices;
                 std::vector<typename Polyhedron::Facet_handle> patch_faces;
                 CGAL::Polygon_mesh_processing::triangulate_refine_and_fair_hole(m, hh, std::back_inserter(patch_faces), std::back_inserter(patch_vertices));
+                if(diagnostics != nullptr)
+                {
+                    diagnostics->_nb_holes_refined_faired++;
+                }
                 if(patch != nullptr)
                 {
                     patch->emplace_back(std::move(patch_vertices), std::move(patch_faces));
@@ -375,6 +934,10 @@ void FixMesh(
                 std::vector<typename Polyhedron::Vertex_handle> patch_vertices;
                 std::vector<typename Polyhedron::Facet_handle> patch_faces;
                 CGAL::Polygon_mesh_processing::triangulate_and_refine_hole(m, hh, std::back_inserter(patch_faces), std::back_inserter(patch_vertices));
+                if(diagnostics != nullptr)
+                {
+                    diagnostics->_nb_holes_refined++;
+                }
                 if(patch != nullptr)
                 {
                     patch->emplace_back(std::move(patch_vertices), std::move(patch_faces));
@@ -384,6 +947,10 @@ void FixMesh(
             {
                 std::vector<typename Polyhedron::Facet_handle> patch_faces;
                 CGAL::Polygon_mesh_processing::triangulate_hole(m, hh, std::back_inserter(patch_faces));
+                if(diagnostics != nullptr)
+                {
+                    diagnostics->_nb_holes_triangulated++;
+                }
             }
         }
     }
@@ -403,48 +970,79 @@ void FixMeshWithLabel(
     float max_hole_diam,
     bool refine,
     int max_retry,
-    std::vector<std::pair<std::vector<typename Polyhedron::Vertex_handle>, std::vector<typename Polyhedron::Facet_handle>>>* patch = nullptr)
+    std::vector<std::pair<std::vector<typename Polyhedron::Vertex_handle>, std::vector<typename Polyhedron::Facet_handle>>>* patch = nullptr,
+    int nb_tiles = 0,
+    FixMeshDiagnostics* diagnostics = nullptr,
+    bool repair_soup = false)
 {
     using Kernel = typename Polyhedron::Traits;
     using Triangle = TTriangle<typename Polyhedron::Vertex::size_type>;
-    auto faces = internal::FixRoundingOrder<Kernel, typename Triangle::size_type>(input_vertices, input_faces);
+    std::vector<Triangle> faces = input_faces;
+    if(repair_soup)
+    {
+        internal::StageTimer timer(diagnostics, "repair_soup");
+        faces = internal::RepairSoup<Kernel, typename Triangle::size_type>(input_vertices, input_faces);
+    }
+    {
+        internal::StageTimer timer(diagnostics, "fix_rounding");
+        faces = internal::FixRoundingOrder<Kernel, typename Triangle::size_type>(input_vertices, faces);
+    }
     std::cout << "After fix rounding F=" << faces.size() << std::endl;
     size_t nb_removed_faces = 0;
     int cnt = 0;
-    do
     {
-        faces = internal::RemoveNonManifold<Kernel, typename Triangle::size_type>(input_vertices, faces, &nb_removed_faces);
-        if (cnt++ >= max_retry)
-            break;
-    } while (nb_removed_faces != 0);
+        internal::StageTimer timer(diagnostics, "remove_non_manifold");
+        do
+        {
+            faces = internal::RemoveNonManifold<Kernel, typename Triangle::size_type>(input_vertices, faces, &nb_removed_faces, nb_tiles, cnt == 0 ? diagnostics : nullptr);
+            if (cnt++ >= max_retry)
+                break;
+        } while (nb_removed_faces != 0);
+    }
+    if(diagnostics != nullptr)
+    {
+        diagnostics->_nb_nm_retry = cnt;
+    }
     if (cnt >= max_retry)
     {
         throw AlgError("Cannot remove non-manifold parts. Try increasing retry times.");
     }
     Polyhedron& m = output_mesh;
     m.clear();
-    m.BuildFromVerticesFaces(input_vertices, faces);
-
-    m.LoadLabels(input_labels);
-
-    CGAL::Polygon_mesh_processing::remove_isolated_vertices(m);
+    {
+        internal::StageTimer timer(diagnostics, "build");
+        m.BuildFromVerticesFaces(input_vertices, faces);
+        m.LoadLabels(input_labels);
+        CGAL::Polygon_mesh_processing::remove_isolated_vertices(m);
+    }
 
     if (fix_self_intersection)
     {
-        internal::FixSelfIntersection(m, max_retry);
+        internal::StageTimer timer(diagnostics, "self_intersection");
+        internal::FixSelfIntersection(m, max_retry, nb_tiles, diagnostics);
     }
 
     if (keep_largest_connected_component)
     {
-        size_t num = CGAL::Polygon_mesh_processing::keep_large_connected_components(m, large_cc_threshold);
+        internal::StageTimer timer(diagnostics, "connected_components");
+        size_t num = internal::RemoveSmallComponents(m, large_cc_threshold);
         if (gVerbose)
         {
             std::cout << "Remove " << num << " small connected components." << std::endl;
         }
+        if(diagnostics != nullptr)
+        {
+            diagnostics->_nb_removed_components = num;
+        }
     }
 
+    internal::StageTimer timer(diagnostics, "fill_holes");
     std::vector<typename Polyhedron::Halfedge_handle> border_edges;
     CGAL::Polygon_mesh_processing::extract_boundary_cycles(m, std::back_inserter(border_edges));
+    if(diagnostics != nullptr)
+    {
+        diagnostics->_nb_holes = border_edges.size();
+    }
     for (typename Polyhedron::Halfedge_handle hh : border_edges)
     {
         if (!filter_small_holes || (filter_small_holes && m.IsSmallHole(hh, max_hole_edges, max_hole_diam)))
@@ -454,26 +1052,14 @@ void FixMeshWithLabel(
                 std::vector<typename Polyhedron::Vertex_handle> patch_vertices;
                 std::vector<typename Polyhedron::Facet_handle> patch_faces;
                 CGAL::Polygon_mesh_processing::triangulate_and_refine_hole(m, hh, std::back_inserter(patch_faces), std::back_inserter(patch_vertices));
+                if(diagnostics != nullptr)
+                {
+                    diagnostics->_nb_holes_refined++;
+                }
 
                 // labels of patch vertices
                 std::unordered_set<typename Polyhedron::Vertex_handle> patch_vset(patch_vertices.begin(), patch_vertices.end());
-                std::unordered_set<typename Polyhedron::Vertex_handle> neighbor_vset;
-                for(auto hv : patch_vset)
-                {
-                    for(auto nei : CGAL::vertices_around_target(hv, m))
-                    {
-                        if(patch_vset.count(nei) == 0)
-                        {
-                            neighbor_vset.insert(nei);
-                        }
-                    }
-                }
-                for(auto hv : patch_vset)
-                {
-                    auto nearest = *std::min_element(neighbor_vset.begin(), neighbor_vset.end(), [&](auto& lh, auto& rh) 
-                        { return CGAL::squared_distance(lh->point(), hv->point()) < CGAL::squared_distance(rh->point(), hv->point()); });
-                    hv->_label = nearest->_label;
-                }
+                TransferLabelsFromSurroundings(m, patch_vertices, [&](auto hv, auto nei) { return patch_vset.count(nei) == 0; });
                 if(patch != nullptr)
                 {
                     patch->emplace_back(std::move(patch_vertices), std::move(patch_faces));
@@ -483,6 +1069,10 @@ void FixMeshWithLabel(
             {
                 std::vector<typename Polyhedron::Facet_handle> patch_faces;
                 CGAL::Polygon_mesh_processing::triangulate_hole(m, hh, std::back_inserter(patch_faces));
+                if(diagnostics != nullptr)
+                {
+                    diagnostics->_nb_holes_triangulated++;
+                }
                 if(patch != nullptr)
                 {
                     patch->emplace_back(std::vector<typename Polyhedron::Vertex_handle>(), std::move(patch_faces));
@@ -492,6 +1082,33 @@ void FixMeshWithLabel(
     }
 }
 
+// Soups that are already a valid mesh are built as they are, so vertices keep matching labels. Only the
+// others are repaired and fixed.
+template <typename Polyhedron>
+void LoadMeshWithLabel(const std::vector<typename Polyhedron::Traits::Point_3>& vertices,
+    std::vector<TTriangle<typename Polyhedron::Vertex::size_type>> faces, const std::vector<int>& labels, Polyhedron& mesh)
+{
+    if(CGAL::Polygon_mesh_processing::is_polygon_soup_a_polygon_mesh(faces))
+    {
+        mesh.BuildFromVerticesFaces(vertices, faces);
+        mesh.LoadLabels(labels);
+    }
+    else
+    {
+        printf("possible invalid mesh, try fixing...\n");
+        FixMeshWithLabel(vertices, faces, labels, mesh, false, 0, false, false, 0, 0, false, 10, nullptr, 0, nullptr, true);
+    }
+}
 
+template <typename Polyhedron>
+void LoadMeshWithLabel(const std::string& path, const std::vector<int>& labels, Polyhedron& mesh)
+{
+    using Kernel = typename Polyhedron::Traits;
+    using Triangle = TTriangle<typename Polyhedron::Vertex::size_type>;
+    std::vector<typename Kernel::Point_3> vertices;
+    std::vector<Triangle> faces;
+    LoadVFSoup<Kernel, typename Triangle::size_type>(path, vertices, faces);
+    LoadMeshWithLabel(vertices, std::move(faces), labels, mesh);
+}
 
-#endif
\ No newline at end of file
+#endif
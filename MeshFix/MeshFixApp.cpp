@@ -1,4 +1,5 @@
 #include "MeshFix.h"
+#include <fstream>
 #include <argparse/argparse.hpp>
 
 extern bool gVerbose;
@@ -16,6 +17,10 @@ int main(int argc, char* argv[])
     argparse.add_argument("--smallhole_size", "-ss").help("holes whose edge bounding box smaller than the value are closed.").nargs(1).scan<'f', float>().default_value(0.0f);
     argparse.add_argument("--refine", "-r").help("refine the filled holes.").flag();
     argparse.add_argument("--max_retry", "-m").help("max retry number to fix the mesh.").scan<'i', int>().default_value(10);
+    argparse.add_argument("--tiles", "-t").help("split large meshes into about this many spatial tiles and repair them in parallel. 0 disables tiling.").scan<'i', int>().default_value(0);
+    argparse.add_argument("--repair_soup").flag().help("before anything else, drop faces with bad indices, collinear and duplicate faces, and make the orientation consistent.");
+    argparse.add_argument("--diagnostics", "-d").help("write counters and per-stage timings of the repair to this json file.");
+    argparse.add_argument("--trace").default_value("").help("write a Chrome trace of the repair stages to this json file (needs a build with ORTHO_PROFILE).");
     try
     {
         argparse.parse_args(argc, argv);
@@ -25,6 +30,7 @@ int main(int argc, char* argv[])
         std::cout << e.what() << std::endl;
         return -1;
     }
+    Profiler::Session session(argparse.get("--trace"));
     try
     {
         std::string path = argparse.get("-i");
@@ -39,6 +45,10 @@ int main(int argc, char* argv[])
         bool filter_small_holes = smallhole_edge_num <= 2 && smallhole_size <= 0.0;
         bool refine = argparse.get<bool>("--refine");
         int max_retry = argparse.get<int>("--max_retry");
+        int nb_tiles = argparse.get<int>("--tiles");
+        bool repair_soup = argparse.get<bool>("--repair_soup");
+        std::string diagnostics_path = argparse.present("--diagnostics").value_or("");
+        FixMeshDiagnostics diagnostics;
         if(!input_label.empty() && !output_label.empty())
         {
             FixMeshFileWithLabel(
@@ -53,7 +63,10 @@ int main(int argc, char* argv[])
                 smallhole_edge_num, 
                 smallhole_size, 
                 refine,
-                max_retry
+                max_retry,
+                nb_tiles,
+                diagnostics_path.empty() ? nullptr : &diagnostics,
+                repair_soup
             );
         }
         else
@@ -68,9 +81,21 @@ int main(int argc, char* argv[])
                 smallhole_edge_num, 
                 smallhole_size, 
                 refine,
-                max_retry
+                max_retry,
+                nb_tiles,
+                diagnostics_path.empty() ? nullptr : &diagnostics,
+                repair_soup
             );
         }
+        if(!diagnostics_path.empty())
+        {
+            std::ofstream ofs(diagnostics_path);
+            if(ofs.fail())
+            {
+                throw IOError("Cannot write diagnostics file: " + diagnostics_path);
+            }
+            ofs << diagnostics.ToJson().dump(4);
+        }
     }
     catch( const std::exception& e)
     {
@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <array>
 #include <iostream>
 #include <argparse/argparse.hpp>
 #include <CGAL/boost/graph/io.h>
@@ -11,7 +13,10 @@
 #include <CGAL/Polygon_mesh_processing/repair_degeneracies.h>
 #include <CGAL/Vector_3.h>
 #include "../Polyhedron.h"
+#include "../CurveSmoothing.h"
 #include "../MeshFix/MeshFix.h"
+#include "../ParallelJobs.h"
+#include "../Profiler.h"
 #include "../EasyOBJ.h"
 //#define DEBUG_ORTHOSCANBASE
 using KernelEpick = CGAL::Exact_predicates_inexact_constructions_kernel;
@@ -281,19 +286,16 @@ void GenerateBase2(Polyhedron &mesh)
         hole_vertices.push_back(hh->vertex());
     }
     {
-        for(int ite = 0; ite < 3; ite++)
+        TClosedPolyline<> polyline;
+        polyline.Resize(hole_vertices.size());
+        for(size_t i = 0; i < hole_vertices.size(); i++)
         {
-            std::vector<Polyhedron::Traits::Kernel::Point_3> new_points;
-            for(size_t i = 0; i < hole_vertices.size(); i++)
-            {
-                size_t prev = i == 0 ? hole_vertices.size() - 1 : i - 1;
-                size_t next = (i + 1) % hole_vertices.size();
-                new_points.push_back(CGAL::midpoint(hole_vertices[prev]->point(), hole_vertices[next]->point()));
-            }
-            for(size_t i = 0; i < hole_vertices.size(); i++)
-            {
-                hole_vertices[i]->point() = new_points[i];
-            }
+            polyline.Set(i, hole_vertices[i]->point());
+        }
+        polyline.Laplacian(1.0, 3);
+        for(size_t i = 0; i < hole_vertices.size(); i++)
+        {
+            hole_vertices[i]->point() = polyline.Get<KernelEpick::Point_3>(i);
         }
     }
 
@@ -450,27 +452,28 @@ void Optimize(Polyhedron &mesh)
     mesh.UpdateFaceLabels();
 }
 
-int main(int argc, char *argv[])
+// Optimize the scan and generate its base. Errors in the processing are printed and the mesh is written as it is.
+void ProcessScan(const std::string& input_file, const std::string& input_label, const std::string& output_file, const std::string& output_label)
 {
-    argparse::ArgumentParser parser;
-    parser.add_argument("--input_file", "-i").required().help("specify the input mesh.");
-    parser.add_argument("--input_label", "-l").required().help("specify the input labels.");
-    parser.add_argument("--output_file", "-o").required().help("specify the output file.");
-    parser.add_argument("--output_label", "-ol").required().help("specify the output labels.");
-    parser.parse_args(argc, argv);
-
     Polyhedron mesh;
-    CGAL::IO::read_polygon_mesh(parser.get("-i"), mesh, CGAL::parameters::verbose(true));
-    mesh.LoadLabels(parser.get("-l"));
+    {
+        ORTHO_PROFILE_SCOPE("load");
+        CGAL::IO::read_polygon_mesh(input_file, mesh, CGAL::parameters::verbose(true));
+        mesh.LoadLabels(input_label);
+    }
     try
     {
         std::cout << "Optimizing...";
-        Optimize(mesh);
+        {
+            ORTHO_PROFILE_SCOPE("optimize");
+            Optimize(mesh);
+        }
         std::cout << "Done." << std::endl;
 #ifdef DEBUG_ORTHOSCANBASE
         mesh.WriteOBJ("optimized.obj");
 #endif
         std::cout << "Generating...";
+        ORTHO_PROFILE_SCOPE("generate_base");
         GenerateBase2(mesh);
         std::cout << "Done." << std::endl;
     }
@@ -479,7 +482,60 @@ int main(int argc, char *argv[])
         std::cout << e.what() << std::endl;
     }
 
-    mesh.WriteOBJ(parser.get("-o"));
-    mesh.WriteLabels(parser.get("-ol"));
-    return 0;
-}
\ No newline at end of file
+    ORTHO_PROFILE_SCOPE("write");
+    mesh.WriteOBJ(output_file);
+    mesh.WriteLabels(output_label);
+}
+
+int main(int argc, char *argv[])
+{
+    argparse::ArgumentParser parser;
+    parser.add_argument("--input_file", "-i").required().help("specify the input mesh.");
+    parser.add_argument("--input_label", "-l").required().help("specify the input labels.");
+    parser.add_argument("--output_file", "-o").required().help("specify the output file.");
+    parser.add_argument("--output_label", "-ol").required().help("specify the output labels.");
+    parser.add_argument("--pair_input_file", "-i2").default_value("").help("specify the mesh of the other arch to process at the same time, sharing the threads.");
+    parser.add_argument("--pair_input_label", "-l2").default_value("").help("specify the labels of the other arch.");
+    parser.add_argument("--pair_output_file", "-o2").default_value("").help("specify the output file of the other arch.");
+    parser.add_argument("--pair_output_label", "-ol2").default_value("").help("specify the output labels of the other arch.");
+    parser.add_argument("--trace").default_value("").help("write a Chrome trace of the processing stages to this json file (needs a build with ORTHO_PROFILE).");
+    parser.parse_args(argc, argv);
+
+    Profiler::Session session(parser.get("--trace"));
+    std::vector<std::array<std::string, 4>> scans = { { parser.get("-i"), parser.get("-l"), parser.get("-o"), parser.get("-ol") } };
+    const std::array<std::string, 4> pair = { parser.get("-i2"), parser.get("-l2"), parser.get("-o2"), parser.get("-ol2") };
+    const size_t nb_pair_args = std::count_if(pair.begin(), pair.end(), [](const std::string& arg) { return !arg.empty(); });
+    if(nb_pair_args != 0 && nb_pair_args != pair.size())
+    {
+        std::cout << "Invalid arguments: the other arch needs all of -i2, -l2, -o2 and -ol2." << std::endl;
+        return -1;
+    }
+    if(nb_pair_args != 0)
+    {
+        scans.push_back(pair);
+    }
+    // one job per arch; a pair runs concurrently with the threads split between them.
+    auto errors = RunParallelJobs(static_cast<int>(scans.size()), 0, [&](int i) {
+        ProcessScan(scans[i][0], scans[i][1], scans[i][2], scans[i][3]);
+    });
+    int ret = 0;
+    for(size_t i = 0; i < errors.size(); i++)
+    {
+        try
+        {
+            if(errors[i])
+                std::rethrow_exception(errors[i]);
+        }
+        catch(const std::exception& e)
+        {
+            std::cout << scans[i][0] << ": " << e.what() << std::endl;
+            ret = -1;
+        }
+        catch(...)
+        {
+            std::cout << scans[i][0] << ": unknown error" << std::endl;
+            ret = -1;
+        }
+    }
+    return ret;
+}
@@ -13,6 +13,7 @@
 #include "../EasyOBJ.h"
 #include "../MathTypeConverter.h"
 #include "../MeshFix/MeshFix.h"
+#include "../Profiler.h"
 
 template <typename MeshType, int WNum>
 class OrthoScanDeform
@@ -160,6 +161,7 @@ public:
         }
         for (int step = 0; step < frames.size(); step++)
         {
+            ORTHO_PROFILE_SCOPE("deform_step");
             printf("preprocessing...");
             CGAL::set_halfedgeds_items_id(mesh);
 
@@ -216,7 +218,12 @@ public:
             // }
             deformation.insert_control_vertices(control_vertices.begin(), control_vertices.end());
 
-            if(!deformation.preprocess())
+            bool preprocessed = false;
+            {
+                ORTHO_PROFILE_SCOPE("deform_preprocess");
+                preprocessed = deformation.preprocess();
+            }
+            if(!preprocessed)
             {
                 throw AlgError("Failed to deform step " + std::to_string(step));
             }
@@ -266,7 +273,10 @@ public:
             mesh.WriteOBJ("mid" + std::to_string(step) + ".obj");
 
             printf("deform...");
-            deformation.deform(10, 1e-4);
+            {
+                ORTHO_PROFILE_SCOPE("deform_solve");
+                deformation.deform(10, 1e-4);
+            }
 
             printf("optimize...");
             std::unordered_set<typename MeshType::Facet_handle> faces_to_remove;
@@ -302,19 +312,23 @@ public:
             auto [vertices, faces] = mesh.ToVerticesTriangles();
             std::vector<std::pair<std::vector<typename MeshType::Vertex_handle>, std::vector<typename MeshType::Facet_handle>>> patch;
             FixMeshWithLabel(vertices, faces, mesh.WriteLabels(), mesh, true, 1000, true, false, 100, 100, true, 10, &patch);
-            for (auto &pair : patch)
             {
-                std::unordered_set<typename MeshType::Vertex_handle> vertex_to_smooth;
-                for (auto hf : pair.second)
+                ORTHO_PROFILE_SCOPE("fair");
+                for (auto &pair : patch)
                 {
-                    vertex_to_smooth.insert(hf->halfedge()->vertex());
-                    vertex_to_smooth.insert(hf->halfedge()->next()->vertex());
-                    vertex_to_smooth.insert(hf->halfedge()->prev()->vertex());
+                    std::unordered_set<typename MeshType::Vertex_handle> vertex_to_smooth;
+                    for (auto hf : pair.second)
+                    {
+                        vertex_to_smooth.insert(hf->halfedge()->vertex());
+                        vertex_to_smooth.insert(hf->halfedge()->next()->vertex());
+                        vertex_to_smooth.insert(hf->halfedge()->prev()->vertex());
+                    }
+                    CGAL::Polygon_mesh_processing::fair(
+                        mesh, std::vector<typename MeshType::Vertex_handle>(vertex_to_smooth.begin(), vertex_to_smooth.end()));
                 }
-                CGAL::Polygon_mesh_processing::fair(
-                    mesh, std::vector<typename MeshType::Vertex_handle>(vertex_to_smooth.begin(), vertex_to_smooth.end()));
             }
             mesh.UpdateFaceLabels();
+            ORTHO_PROFILE_SCOPE("write");
             mesh.WriteOBJ("deformed_step" + std::to_string(step) + ".obj");
             mesh.WriteLabels("deformed_step" + std::to_string(step) + ".json");
             printf("finishing...");
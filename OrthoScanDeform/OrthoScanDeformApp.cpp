@@ -163,6 +163,7 @@ int main(int argc, char* argv[])
     argparse.add_argument("--path_file", "-p").required();
     argparse.add_argument("--cbct_regis_file", "-c").required();
     argparse.add_argument("--cbct_teeth", "-t").required();
+    argparse.add_argument("--trace").default_value("");
     try
     {
         argparse.parse_args(argc, argv);
@@ -188,38 +189,23 @@ int main(int argc, char* argv[])
     cbct_regis_file = "registration.json";
     cbct_teeth = "teeth_fdi.glb";
 #endif
+    Profiler::Session session(argparse.get("--trace"));
     auto start_time = std::chrono::high_resolution_clock::now();
     Polyhedron mesh;
-    if (!CGAL::IO::read_polygon_mesh(input_file, mesh, CGAL::parameters::verbose(true)))
+    try
     {
-        try
-        {
-            printf("possible invalid mesh, try fixing...\n");
-            std::vector<typename Polyhedron::Traits::Point_3> vertices;
-            std::vector<TTriangle<size_t>> faces;
-            if(input_file.ends_with(".obj"))
-            {
-                LoadVFObj<typename Polyhedron::Traits, size_t>(input_file, vertices, faces);
-            }
-            else
-            {
-                // TODO: add custom file loading function for more formats, since assimp cannot keep vertex order sometimes.
-                LoadVFAssimp<typename Polyhedron::Traits, size_t>(input_file, vertices, faces);
-            }
-            std::vector<int> labels = LoadLabels(label_file);
-            FixMeshWithLabel(vertices, faces, labels, mesh, false, 0, false, false, 0, 0, false, 10);
-        }
-        catch(const std::exception&)
-        {
-            throw IOError("Cannot read mesh file or mesh invalid: " + input_file);
-        }
+        ORTHO_PROFILE_SCOPE("load");
+        LoadMeshWithLabel(input_file, LoadLabels(label_file), mesh);
+    }
+    catch(const std::exception&)
+    {
+        throw IOError("Cannot read mesh file or mesh invalid: " + input_file);
     }
-    else
     {
-        mesh.LoadLabels(label_file);
+        ORTHO_PROFILE_SCOPE("repair");
+        auto [vertices, faces] = mesh.ToVerticesTriangles();
+        FixMeshWithLabel(vertices, faces, mesh.WriteLabels(), mesh, true, 1000, true, false, 100, 100, true, 10);
     }
-    auto [vertices, faces] = mesh.ToVerticesTriangles();
-    FixMeshWithLabel(vertices, faces, mesh.WriteLabels(), mesh, true, 1000, true, false, 100, 100, true, 10);
 
     for(auto hv : CGAL::vertices(mesh))
     {
@@ -0,0 +1,69 @@
+#ifndef PARALLEL_JOBS_H
+#define PARALLEL_JOBS_H
+#include <algorithm>
+#include <exception>
+#include <vector>
+#include <omp.h>
+
+// Run fn(0), ..., fn(nb_jobs - 1) concurrently on nb_threads OpenMP threads (all available if nb_threads <= 0).
+// With fewer jobs than threads the spare threads go to the parallel loops inside the jobs, so the upper and
+// lower arch of a case run at the same time with half of the threads each. Returns the exception thrown by
+// each job, if any; a failed job does not stop the others.
+// The nesting needs OpenMP 3.0 (max active levels). Older runtimes, like the default /openmp of MSVC, run the
+// jobs one after another, each with all the threads for its loops.
+template <typename Fn>
+std::vector<std::exception_ptr> RunParallelJobs(int nb_jobs, int nb_threads, Fn fn)
+{
+    std::vector<std::exception_ptr> errors(nb_jobs);
+    if(nb_jobs <= 0)
+    {
+        return errors;
+    }
+    if(nb_threads <= 0)
+    {
+        nb_threads = omp_get_max_threads();
+    }
+#if _OPENMP >= 200805
+    const int nb_teams = std::min(nb_jobs, nb_threads);
+    const int saved_levels = omp_get_max_active_levels();
+    // one job runs alone and keeps the usual single level of parallelism for its loops.
+    if(nb_teams > 1 && nb_threads > nb_teams)
+    {
+        omp_set_max_active_levels(std::max(saved_levels, omp_get_active_level() + 2));
+    }
+#pragma omp parallel for schedule(dynamic) num_threads(nb_teams)
+    for(int i = 0; i < nb_jobs; i++)
+    {
+        // the first nb_threads % nb_teams teams take one of the remaining threads.
+        const int team = omp_get_thread_num();
+        omp_set_num_threads(nb_threads / nb_teams + (team < nb_threads % nb_teams ? 1 : 0));
+        try
+        {
+            fn(i);
+        }
+        catch(...)
+        {
+            errors[i] = std::current_exception();
+        }
+    }
+    omp_set_max_active_levels(saved_levels);
+#else
+    const int saved_threads = omp_get_max_threads();
+    omp_set_num_threads(nb_threads);
+    for(int i = 0; i < nb_jobs; i++)
+    {
+        try
+        {
+            fn(i);
+        }
+        catch(...)
+        {
+            errors[i] = std::current_exception();
+        }
+    }
+    omp_set_num_threads(saved_threads);
+#endif
+    return errors;
+}
+
+#endif
@@ -18,6 +18,7 @@
 #include <CGAL/Polyhedron_3.h>
 #include <CGAL/Polyhedron_incremental_builder_3.h>
 #include <CGAL/Polyhedron_items_with_id_3.h>
+#include <CGAL/IO/polygon_soup_io.h>
 #include <nlohmann/json.hpp>
 #include "Ortho.h"
 
@@ -35,7 +36,12 @@ public:
     }
     SizeType &operator[](uint32_t i) { return _id[i]; }
     const SizeType &operator[](uint32_t i) const { return _id[i]; }
-    std::pair<SizeType, SizeType> GetEdge(uint32_t i)
+    SizeType *begin() { return _id; }
+    SizeType *end() { return _id + 3; }
+    const SizeType *begin() const { return _id; }
+    const SizeType *end() const { return _id + 3; }
+    size_t size() const { return 3; }
+    std::pair<SizeType, SizeType> GetEdge(uint32_t i) const
     {
         switch (i)
         {
@@ -418,40 +424,35 @@ public:
     {
         for(auto hf = this->facets_begin(); hf != this->facets_end(); hf++)
         {
-            int l0 = hf->halfedge()->vertex()->_label;
-            int l1 = hf->halfedge()->next()->vertex()->_label;
-            int l2 = hf->halfedge()->prev()->vertex()->_label;
-            if(l0 == l1 && l0 == l2)
-            {
-                hf->_label = l0;
-                continue;
-            }
-            if(l0 == 0 || l1 == 0 || l2 == 0)
-            {
-                hf->_label = 0;
-                continue;
-            }
-            if(l0 != l1 && l0 != l2 && l1 != l2)
-            {
-                hf->_label = std::max(l0, std::max(l1, l2));
-                continue;
-            }
-            if(l0 == l1 && l0 != l2)
-            {
-                hf->_label = l0;
-                continue;
-            }
-            if(l1 == l2 && l1 != l0)
-            {
-                hf->_label = l1;
-                continue;
-            }
-            if(l0 == l2 && l0 != l1)
-            {
-                hf->_label = l0;
-                continue;
-            }
+            hf->_label = FaceLabelFromVertices(hf->halfedge()->vertex()->_label, hf->halfedge()->next()->vertex()->_label,
+                hf->halfedge()->prev()->vertex()->_label);
+        }
+    }
+
+    // Face label as UpdateFaceLabels2 computes it from the labels of its three vertices.
+    static int FaceLabelFromVertices(int l0, int l1, int l2)
+    {
+        if(l0 == l1 && l0 == l2)
+        {
+            return l0;
         }
+        if(l0 == 0 || l1 == 0 || l2 == 0)
+        {
+            return 0;
+        }
+        if(l0 != l1 && l0 != l2 && l1 != l2)
+        {
+            return std::max(l0, std::max(l1, l2));
+        }
+        if(l0 == l1 && l0 != l2)
+        {
+            return l0;
+        }
+        if(l1 == l2 && l1 != l0)
+        {
+            return l1;
+        }
+        return l0;
     }
 
     void WriteLabels( const std::string& path ) const
@@ -805,6 +806,29 @@ void LoadVFObj( const std::string& path, std::vector<typename Kernel::Point_3>&
     }
 }
 
+template <typename Kernel, typename SizeType>
+void LoadVFSoup( const std::string& path, std::vector<typename Kernel::Point_3>& vertices, std::vector<TTriangle<SizeType>>& faces )
+{
+    std::vector<std::vector<SizeType>> polygons;
+    vertices.clear();
+    faces.clear();
+    if(!CGAL::IO::read_polygon_soup(path, vertices, polygons))
+    {
+        // formats CGAL cannot read go through assimp, as before.
+        vertices.clear();
+        LoadVFAssimp<Kernel, SizeType>(path, vertices, faces);
+        return;
+    }
+    faces.reserve(polygons.size());
+    for(const auto& polygon : polygons)
+    {
+        for(size_t i = 2; i < polygon.size(); i++)
+        {
+            faces.emplace_back(polygon[0], polygon[i - 1], polygon[i]);
+        }
+    }
+}
+
 template <typename Kernel, typename SizeType>
 void WriteVFObj( const std::string& path, std::vector<typename Kernel::Point_3>& vertices, std::vector<TTriangle<SizeType>>& faces )
 {
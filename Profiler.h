@@ -0,0 +1,285 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include <utility>
+#ifdef ORTHO_PROFILE
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <vector>
+#include <nlohmann/json.hpp>
+#endif
+
+// Scoped timers and counters of the main processing stages, written as Chrome trace events (open the file in
+// chrome://tracing or ui.perfetto.dev) and as a summary table. Only built with ORTHO_PROFILE defined; otherwise
+// ORTHO_PROFILE_SCOPE and ORTHO_PROFILE_COUNTER expand to nothing and the functions below do nothing.
+// Recording starts with Profiler::Start, so an instrumented build costs one atomic load per scope until then.
+namespace Profiler
+{
+#ifdef ORTHO_PROFILE
+namespace internal
+{
+struct Event
+{
+    std::string _name;
+    char _phase; // 'X' complete event, 'C' counter
+    long long _ts;
+    long long _dur;
+    double _value;
+    int _tid;
+};
+
+struct State
+{
+    std::atomic<bool> _enabled{false};
+    std::atomic<int> _nb_threads{0};
+    std::mutex _mutex;
+    std::vector<Event> _events;
+    std::chrono::steady_clock::time_point _epoch = std::chrono::steady_clock::now();
+};
+
+inline State& GetState()
+{
+    static State state;
+    return state;
+}
+
+// Microseconds since Start.
+inline long long Now()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - GetState()._epoch).count();
+}
+
+// Small sequential thread ids read better in the trace viewer than hashed std::thread::id.
+inline int ThreadId()
+{
+    thread_local int id = GetState()._nb_threads++;
+    return id;
+}
+
+inline void Record(Event event)
+{
+    State& state = GetState();
+    std::lock_guard<std::mutex> lock(state._mutex);
+    state._events.push_back(std::move(event));
+}
+}
+
+inline bool Enabled()
+{
+    return internal::GetState()._enabled.load(std::memory_order_relaxed);
+}
+
+// Drop the recorded events and start recording.
+inline void Start()
+{
+    internal::State& state = internal::GetState();
+    std::lock_guard<std::mutex> lock(state._mutex);
+    state._events.clear();
+    state._epoch = std::chrono::steady_clock::now();
+    state._enabled = true;
+}
+
+inline void Stop()
+{
+    internal::GetState()._enabled = false;
+}
+
+class Scope
+{
+public:
+    explicit Scope(std::string_view name)
+    {
+        if(Enabled())
+        {
+            _name = name;
+            _start = internal::Now();
+        }
+    }
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+    ~Scope()
+    {
+        if(_start >= 0)
+        {
+            internal::Record({std::string(_name), 'X', _start, internal::Now() - _start, 0.0, internal::ThreadId()});
+        }
+    }
+
+protected:
+    std::string_view _name;
+    long long _start = -1;
+};
+
+inline void Counter(std::string_view name, double value)
+{
+    if(Enabled())
+    {
+        internal::Record({std::string(name), 'C', internal::Now(), 0, value, internal::ThreadId()});
+    }
+}
+
+inline bool WriteChromeTrace(const std::string& path)
+{
+    internal::State& state = internal::GetState();
+    nlohmann::json events = nlohmann::json::array();
+    {
+        std::lock_guard<std::mutex> lock(state._mutex);
+        for(const auto& e : state._events)
+        {
+            nlohmann::json js;
+            js["name"] = e._name;
+            js["ph"] = std::string(1, e._phase);
+            js["ts"] = e._ts;
+            js["pid"] = 0;
+            js["tid"] = e._tid;
+            if(e._phase == 'X')
+                js["dur"] = e._dur;
+            else
+                js["args"]["value"] = e._value;
+            events.push_back(js);
+        }
+    }
+    nlohmann::json trace;
+    trace["traceEvents"] = events;
+    trace["displayTimeUnit"] = "ms";
+    std::ofstream ofs(path);
+    if(ofs.fail())
+    {
+        return false;
+    }
+    ofs << trace.dump();
+    return !ofs.fail();
+}
+
+// One line per scope name with call count, total, mean and max milliseconds, sorted by total time, then the
+// last and max value of each counter.
+inline std::string Summary()
+{
+    struct Stat
+    {
+        size_t _count = 0;
+        double _total = 0.0;
+        double _max = 0.0;
+        double _last = 0.0;
+    };
+    std::map<std::string, Stat> scopes;
+    std::map<std::string, Stat> counters;
+    {
+        internal::State& state = internal::GetState();
+        std::lock_guard<std::mutex> lock(state._mutex);
+        for(const auto& e : state._events)
+        {
+            if(e._phase == 'X')
+            {
+                Stat& s = scopes[e._name];
+                s._count++;
+                s._total += e._dur * 1e-3;
+                s._max = std::max(s._max, e._dur * 1e-3);
+            }
+            else
+            {
+                Stat& s = counters[e._name];
+                s._max = s._count++ == 0 ? e._value : std::max(s._max, e._value);
+                s._last = e._value;
+            }
+        }
+    }
+    std::vector<std::pair<std::string, Stat>> sorted(scopes.begin(), scopes.end());
+    std::sort(sorted.begin(), sorted.end(), [](auto& lh, auto& rh) { return lh.second._total > rh.second._total; });
+    std::string out;
+    char line[256];
+    std::snprintf(line, sizeof(line), "%-32s %8s %12s %12s %12s\n", "scope", "calls", "total ms", "mean ms", "max ms");
+    out += line;
+    for(const auto& [name, s] : sorted)
+    {
+        std::snprintf(line, sizeof(line), "%-32s %8zu %12.3f %12.3f %12.3f\n", name.c_str(), s._count, s._total, s._total / s._count, s._max);
+        out += line;
+    }
+    if(!counters.empty())
+    {
+        std::snprintf(line, sizeof(line), "%-32s %8s %12s %12s\n", "counter", "samples", "last", "max");
+        out += line;
+        for(const auto& [name, s] : counters)
+        {
+            std::snprintf(line, sizeof(line), "%-32s %8zu %12g %12g\n", name.c_str(), s._count, s._last, s._max);
+            out += line;
+        }
+    }
+    return out;
+}
+#else
+inline bool Enabled() { return false; }
+inline void Start() {}
+inline void Stop() {}
+class Scope
+{
+public:
+    explicit Scope(std::string_view) {}
+};
+inline void Counter(std::string_view, double) {}
+inline bool WriteChromeTrace(const std::string&) { return false; }
+inline std::string Summary() { return std::string(); }
+#endif
+
+// Records from construction to destruction, then writes the trace to path (or $ORTHO_TRACE if path is empty)
+// and prints the summary. Does nothing if neither is set, and only warns if profiling is not built.
+class Session
+{
+public:
+    explicit Session(std::string path)
+        : _path(std::move(path))
+    {
+        if(_path.empty())
+        {
+            const char* env = std::getenv("ORTHO_TRACE");
+            _path = env != nullptr ? env : "";
+        }
+        if(!_path.empty())
+        {
+            Start();
+        }
+    }
+    Session(const Session&) = delete;
+    Session& operator=(const Session&) = delete;
+    ~Session()
+    {
+        if(_path.empty())
+        {
+            return;
+        }
+        Stop();
+#ifdef ORTHO_PROFILE
+        std::string summary = Summary();
+        std::fputs(summary.c_str(), stdout);
+        if(!WriteChromeTrace(_path))
+        {
+            std::fprintf(stderr, "Cannot write trace file: %s\n", _path.c_str());
+        }
+#else
+        std::fprintf(stderr, "Tracing is not available, rebuild with -DORTHO_PROFILE=ON.\n");
+#endif
+    }
+
+protected:
+    std::string _path;
+};
+}
+
+#ifdef ORTHO_PROFILE
+#define ORTHO_PROFILE_CONCAT_(a, b) a##b
+#define ORTHO_PROFILE_CONCAT(a, b) ORTHO_PROFILE_CONCAT_(a, b)
+#define ORTHO_PROFILE_SCOPE(name) Profiler::Scope ORTHO_PROFILE_CONCAT(profile_scope_, __LINE__)(name)
+#define ORTHO_PROFILE_COUNTER(name, value) Profiler::Counter(name, value)
+#else
+#define ORTHO_PROFILE_SCOPE(name)
+#define ORTHO_PROFILE_COUNTER(name, value)
+#endif
+
+#endif
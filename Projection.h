@@ -0,0 +1,186 @@
+#ifndef PROJECTION_H
+#define PROJECTION_H
+#include <array>
+#include <limits>
+#include <span>
+#include <vector>
+#include <CGAL/boost/graph/iterator.h>
+#include "Ortho.h"
+#include "Profiler.h"
+
+// Build the tree and its distance-query accelerator up front. Both are otherwise built lazily by the
+// first query, which is not safe when the first queries come from several threads.
+template <typename AABBTree>
+void PrepareForProjection(AABBTree& tree)
+{
+    ORTHO_PROFILE_SCOPE("aabb_build");
+    tree.build();
+    tree.accelerate_distance_queries();
+}
+
+namespace internal
+{
+// Barycentric coordinates of p in triangle (a, b, c), p assumed to lie on the triangle.
+template <typename Point>
+std::array<double, 3> Barycentric(const Point& a, const Point& b, const Point& c, const Point& p)
+{
+    auto v0 = b - a;
+    auto v1 = c - a;
+    auto v2 = p - a;
+    double d00 = v0 * v0;
+    double d01 = v0 * v1;
+    double d11 = v1 * v1;
+    double d20 = v2 * v0;
+    double d21 = v2 * v1;
+    double denom = d00 * d11 - d01 * d01;
+    if(denom == 0.0)
+    {
+        return { 1.0, 0.0, 0.0 };
+    }
+    double v = (d11 * d20 - d01 * d21) / denom;
+    double w = (d00 * d21 - d01 * d20) / denom;
+    return { 1.0 - v - w, v, w };
+}
+}
+
+// Project all queries onto the tree in parallel. points receives the closest points; primitives and
+// barycentric are filled when not empty. Barycentric coordinates refer to the vertices
+// (halfedge()->vertex(), halfedge()->next()->vertex(), halfedge()->prev()->vertex()) of the closest face,
+// so they need face graph primitives. queries and points may be the same array.
+// Call PrepareForProjection on the tree first.
+template <typename AABBTree>
+void BatchClosestPoints(const AABBTree& tree,
+    std::span<const typename AABBTree::Point> queries,
+    std::span<typename AABBTree::Point> points,
+    std::span<typename AABBTree::Primitive_id> primitives = {},
+    std::span<std::array<double, 3>> barycentric = {})
+{
+    if(points.size() != queries.size() || (!primitives.empty() && primitives.size() != queries.size())
+        || (!barycentric.empty() && barycentric.size() != queries.size()))
+    {
+        throw AlgError("Output size of batched projection does not match the number of queries");
+    }
+    const bool with_primitive = !primitives.empty() || !barycentric.empty();
+#pragma omp parallel for
+    for(int i = 0; i < queries.size(); i++)
+    {
+        if(!with_primitive)
+        {
+            points[i] = tree.closest_point(queries[i]);
+            continue;
+        }
+        auto [p, id] = tree.closest_point_and_primitive(queries[i]);
+        points[i] = p;
+        if(!primitives.empty())
+        {
+            primitives[i] = id;
+        }
+        if(!barycentric.empty())
+        {
+            auto hh = id->halfedge();
+            barycentric[i] = internal::Barycentric(hh->vertex()->point(), hh->next()->vertex()->point(), hh->prev()->vertex()->point(), p);
+        }
+    }
+}
+
+// Project points in place.
+template <typename AABBTree>
+void BatchClosestPoints(const AABBTree& tree, std::vector<typename AABBTree::Point>& points)
+{
+    BatchClosestPoints(tree, std::span<const typename AABBTree::Point>(points), std::span<typename AABBTree::Point>(points));
+}
+
+// Projection for points that move little between calls, like curve points during smoothing.
+// Each point keeps the id of the face it was last projected to. If the point still projects closer onto that
+// face than onto any face sharing a vertex with it, the projection onto it is kept; otherwise, or when there is
+// no previous face, the point is projected with the tree.
+// Face ids must be set (CGAL::set_halfedgeds_items_id) and the tree must be prepared for projection.
+template <typename Polyhedron, typename AABBTree>
+class TFaceHintProjector
+{
+public:
+    using Kernel = typename Polyhedron::Traits;
+    using Point_3 = typename Kernel::Point_3;
+    using Facet_handle = typename Polyhedron::Facet_handle;
+    static constexpr size_t npos = std::numeric_limits<size_t>::max();
+
+    TFaceHintProjector(const Polyhedron& mesh, const AABBTree& tree)
+        : _mesh(mesh), _tree(tree),
+        _faces(CGAL::faces(mesh).begin(), CGAL::faces(mesh).end())
+    {
+    }
+
+    // Project points in place. face_ids holds the last face of each point and is updated.
+    void Project(std::span<Point_3> points, std::span<size_t> face_ids) const
+    {
+        if(points.size() != face_ids.size())
+        {
+            throw AlgError("Number of points != number of face hints");
+        }
+#pragma omp parallel for
+        for(int i = 0; i < points.size(); i++)
+        {
+            points[i] = ProjectPoint(points[i], face_ids[i]);
+        }
+    }
+
+    // Same for points stored as one array per coordinate, like the ones of a TClosedPolyline.
+    template <typename FT>
+    void Project(std::span<FT> x, std::span<FT> y, std::span<FT> z, std::span<size_t> face_ids) const
+    {
+        if(x.size() != face_ids.size() || y.size() != face_ids.size() || z.size() != face_ids.size())
+        {
+            throw AlgError("Number of points != number of face hints");
+        }
+#pragma omp parallel for
+        for(int i = 0; i < face_ids.size(); i++)
+        {
+            Point_3 p = ProjectPoint(Point_3(x[i], y[i], z[i]), face_ids[i]);
+            x[i] = static_cast<FT>(p.x());
+            y[i] = static_cast<FT>(p.y());
+            z[i] = static_cast<FT>(p.z());
+        }
+    }
+
+protected:
+    typename Kernel::Triangle_3 Triangle(Facet_handle hf) const
+    {
+        auto hh = hf->halfedge();
+        return typename Kernel::Triangle_3(hh->vertex()->point(), hh->next()->vertex()->point(), hh->prev()->vertex()->point());
+    }
+
+    Point_3 ProjectPoint(const Point_3& q, size_t& face_id) const
+    {
+        Point_3 result;
+        if(face_id < _faces.size() && StillClosest(q, _faces[face_id], result))
+        {
+            return result;
+        }
+        auto [p, hf] = _tree.closest_point_and_primitive(q);
+        face_id = hf->id();
+        return p;
+    }
+
+    // Whether q projects onto hf at least as close as onto any face sharing a vertex with hf.
+    bool StillClosest(const Point_3& q, Facet_handle hf, Point_3& result) const
+    {
+        auto project = Kernel().construct_projected_point_3_object();
+        result = project(Triangle(hf), q);
+        const double d = CGAL::squared_distance(result, q);
+        for(auto hh : CGAL::halfedges_around_face(hf->halfedge(), _mesh))
+        {
+            for(auto nei : CGAL::faces_around_target(hh, _mesh))
+            {
+                if(nei != nullptr && nei != hf && CGAL::squared_distance(project(Triangle(nei), q), q) < d)
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    const Polyhedron& _mesh;
+    const AABBTree& _tree;
+    std::vector<Facet_handle> _faces;
+};
+
+#endif
@@ -1,15 +1,79 @@
 #ifdef FOUND_PYBIND11
 #include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
 // #include "ColorMeshByLabel/ColorMeshByLabel.h"
 #include "GumTrimLine/GumTrimLine.h"
 // #include "HoleMerge/HoleMerge.h"
-// #include "MeshFix/MeshFix.h"
+#include "MeshFix/MeshFix.h"
+#include "Profiler.h"
 // #include "ReSegment/ReSegment.h"
 // #include "SegClean/SegClean.h"
 // #include "Polyhedron.h"
 
 namespace py = pybind11;
 
+namespace
+{
+    template <typename T>
+    std::vector<T> FlatArray(const py::handle& obj, size_t cols, const char* name)
+    {
+        auto arr = py::array_t<T, py::array::c_style | py::array::forcecast>::ensure(obj);
+        if(!arr || (cols == 1 ? arr.ndim() != 1 : arr.ndim() != 2 || arr.shape(1) != cols))
+        {
+            throw IOError(std::string(name) + (cols == 1 ? " must be an (N,) array." : " must be an (N," + std::to_string(cols) + ") array."));
+        }
+        return std::vector<T>(arr.data(), arr.data() + arr.size());
+    }
+
+    GumTrimLineJob ToGumTrimLineJob(const py::dict& d)
+    {
+        GumTrimLineJob job;
+        if(d.contains("vertices"))
+        {
+            job.vertices = FlatArray<double>(d["vertices"], 3, "vertices");
+            job.faces = FlatArray<int>(d["faces"], 3, "faces");
+            job.labels = FlatArray<int>(d["labels"], 1, "labels");
+        }
+        else
+        {
+            job.input_file = d["input_mesh"].cast<std::string>();
+            job.label_file = d["input_labels"].cast<std::string>();
+        }
+        if(d.contains("frame_file"))
+            job.frame_file = d["frame_file"].cast<std::string>();
+        if(d.contains("smooth"))
+            job.smooth = d["smooth"].cast<int>();
+        if(d.contains("fix_factor"))
+            job.fix_factor = d["fix_factor"].cast<double>();
+        if(d.contains("roi_width"))
+            job.roi_width = d["roi_width"].cast<double>();
+        if(d.contains("roi_geodesic"))
+            job.roi_geodesic = d["roi_geodesic"].cast<bool>();
+        if(d.contains("proxy_ratio"))
+            job.proxy_ratio = d["proxy_ratio"].cast<double>();
+        return job;
+    }
+
+    py::dict FromGumTrimLineResult(const GumTrimLineResult& result)
+    {
+        py::dict d;
+        if(!result.error.empty())
+        {
+            d["error"] = result.error;
+            return d;
+        }
+        const py::ssize_t n = result.labels.size();
+        py::array_t<double> points({ n, py::ssize_t(3) });
+        std::copy(result.points.begin(), result.points.end(), points.mutable_data());
+        py::array_t<int> labels(n);
+        std::copy(result.labels.begin(), result.labels.end(), labels.mutable_data());
+        d["points"] = points;
+        d["labels"] = labels;
+        d["deviation"] = result.deviation;
+        return d;
+    }
+}
+
 PYBIND11_MODULE(gumTrimLine, m)
 {
     m.doc() = "A set of tools for ortho scan meshes.";
@@ -26,31 +90,50 @@ PYBIND11_MODULE(gumTrimLine, m)
     //     py::arg("output_labels"),
     //     py::arg("size_threshold"));
     
-    // m.def("FixMesh", &FixMeshFile, "Fix non-manifold vertices & edges",
-    //     py::arg("path"),
-    //     py::arg("output_path"),
-    //     py::arg("keep_largest_connected_component"),
-    //     py::arg("large_cc_threshold"),
-    //     py::arg("fix_self_intersection"),
-    //     py::arg("filter_small_holes"),
-    //     py::arg("max_hole_edges"),
-    //     py::arg("max_hole_diam"),
-    //     py::arg("refine"),
-    //     py::arg("max_retry"));
+    m.def("FixMesh", [](std::string path, std::string output_path, bool keep_largest_connected_component, int large_cc_threshold,
+        bool fix_self_intersection, bool filter_small_holes, int max_hole_edges, float max_hole_diam, bool refine, int max_retry, int nb_tiles)
+        {
+            FixMeshDiagnostics diagnostics;
+            FixMeshFile(path, output_path, keep_largest_connected_component, large_cc_threshold, fix_self_intersection,
+                filter_small_holes, max_hole_edges, max_hole_diam, refine, max_retry, nb_tiles, &diagnostics);
+            return py::module_::import("json").attr("loads")(diagnostics.ToJson().dump());
+        },
+        "Fix non-manifold vertices & edges. Returns a dict of counters and per-stage timings.",
+        py::arg("path"),
+        py::arg("output_path"),
+        py::arg("keep_largest_connected_component"),
+        py::arg("large_cc_threshold"),
+        py::arg("fix_self_intersection"),
+        py::arg("filter_small_holes"),
+        py::arg("max_hole_edges"),
+        py::arg("max_hole_diam"),
+        py::arg("refine"),
+        py::arg("max_retry"),
+        py::arg("nb_tiles") = 0);
 
-    // m.def("FixMeshWithLabel", &FixMeshFileWithLabel, "Fix non-manifold vertices & edges and output manipulated vertex label file.",
-    //     py::arg("path"),
-    //     py::arg("output_path"),
-    //     py::arg("input_label"),
-    //     py::arg("output_label"),
-    //     py::arg("keep_largest_connected_component"),
-    //     py::arg("large_cc_threshold"),
-    //     py::arg("fix_self_intersection"),
-    //     py::arg("filter_small_holes"),
-    //     py::arg("max_hole_edges"),
-    //     py::arg("max_hole_diam"),
-    //     py::arg("refine"),
-    //     py::arg("max_retry"));
+    m.def("FixMeshWithLabel", [](std::string path, std::string output_path, std::string input_label, std::string output_label,
+        bool keep_largest_connected_component, int large_cc_threshold, bool fix_self_intersection, bool filter_small_holes,
+        int max_hole_edges, float max_hole_diam, bool refine, int max_retry, int nb_tiles)
+        {
+            FixMeshDiagnostics diagnostics;
+            FixMeshFileWithLabel(path, output_path, input_label, output_label, keep_largest_connected_component, large_cc_threshold,
+                fix_self_intersection, filter_small_holes, max_hole_edges, max_hole_diam, refine, max_retry, nb_tiles, &diagnostics);
+            return py::module_::import("json").attr("loads")(diagnostics.ToJson().dump());
+        },
+        "Fix non-manifold vertices & edges and output manipulated vertex label file. Returns a dict of counters and per-stage timings.",
+        py::arg("path"),
+        py::arg("output_path"),
+        py::arg("input_label"),
+        py::arg("output_label"),
+        py::arg("keep_largest_connected_component"),
+        py::arg("large_cc_threshold"),
+        py::arg("fix_self_intersection"),
+        py::arg("filter_small_holes"),
+        py::arg("max_hole_edges"),
+        py::arg("max_hole_diam"),
+        py::arg("refine"),
+        py::arg("max_retry"),
+        py::arg("nb_tiles") = 0);
 
     // m.def("ReSegment", &ReSegmentLabels, "ReSegment the mesh using the provided splitlines.",
     //     py::arg("input_mesh"),
@@ -66,13 +149,59 @@ PYBIND11_MODULE(gumTrimLine, m)
     //     py::arg("output_mesh"),
     //     py::arg("threshold"));
 
-    m.def("run", &GumTrimLine, "Get gum trim line",
+    m.def("run", py::overload_cast<std::string, std::string, std::string, std::string, int, double, double, bool, double>(&GumTrimLine),
+        "Get gum trim line. The format of output_file follows its extension: .obj, .json, .npy, .bin (float32) or .bin64 (float64).",
         py::arg("input_mesh"),
         py::arg("input_labels"),
         py::arg("frame_file"),
         py::arg("output_file"),
         py::arg("smooth"),
-        py::arg("fix_factor"));
+        py::arg("fix_factor"),
+        py::arg("roi_width") = 0.0,
+        py::arg("roi_geodesic") = false,
+        py::arg("proxy_ratio") = 0.0);
+
+    m.def("batch", [](const py::list& jobs, int num_threads)
+        {
+            std::vector<GumTrimLineJob> cpp_jobs;
+            for(auto item : jobs)
+            {
+                cpp_jobs.push_back(ToGumTrimLineJob(item.cast<py::dict>()));
+            }
+            std::vector<GumTrimLineResult> results;
+            {
+                py::gil_scoped_release release;
+                results = ComputeGumTrimLines(cpp_jobs, num_threads);
+            }
+            py::list out;
+            for(auto& result : results)
+            {
+                out.append(FromGumTrimLineResult(result));
+            }
+            return out;
+        },
+        "Get gum trim lines of many meshes in parallel, without files. Each job is a dict with either "
+        "'input_mesh' and 'input_labels' paths, or 'vertices' (N,3), 'faces' (M,3) and 'labels' (N,) arrays, "
+        "and optionally 'frame_file', 'smooth' (default 3), 'fix_factor' (default 0), 'roi_width' (default 0, whole mesh), "
+        "'roi_geodesic' and 'proxy_ratio' (default 0, no proxy). Returns one dict per job with 'points' (K,3) and "
+        "'labels' (K,) arrays and 'deviation', the largest distance from the proxy trim line to the gum borders of the mesh, or 'error' if the job failed.",
+        py::arg("jobs"),
+        py::arg("num_threads") = 0);
+
+    m.def("profile_start", &Profiler::Start,
+        "Start recording the processing stages of the following calls. Needs a build with ORTHO_PROFILE.");
+
+    m.def("profile_stop", [](std::string trace_file)
+        {
+            Profiler::Stop();
+            if(!trace_file.empty() && !Profiler::WriteChromeTrace(trace_file))
+            {
+                throw IOError("Cannot write trace file: " + trace_file);
+            }
+            return Profiler::Summary();
+        },
+        "Stop recording, write the Chrome trace to trace_file if given and return the summary table.",
+        py::arg("trace_file") = "");
 
     py::register_local_exception<IOError>(m, "IOError");
     py::register_local_exception<MeshError>(m, "MeshError");
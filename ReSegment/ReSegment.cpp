@@ -11,6 +11,10 @@
 #include <CGAL/version.h>
 #include <nlohmann/json.hpp>
 #include "../Polyhedron.h"
+#include "../Components.h"
+#include "../FlatBVH.h"
+#include "../Profiler.h"
+#include "../Projection.h"
 #ifdef FOUND_PYBIND11
 #include <pybind11/pybind11.h>
 #endif
@@ -20,9 +24,13 @@ namespace
 {
     using KernelEpick = CGAL::Exact_predicates_inexact_constructions_kernel;
     using Polyhedron = TPolyhedronWithLabel<ItemsWithLabelFlag, KernelEpick>;
+#ifdef ORTHO_FLAT_BVH
+    using AABBTree = FlatBVH<Polyhedron>;
+#else
     using AABBPrimitive = CGAL::AABB_face_graph_triangle_primitive<Polyhedron>;
     using AABBTraits = CGAL::AABB_traits<KernelEpick, AABBPrimitive>;
     using AABBTree = CGAL::AABB_tree<AABBTraits>;
+#endif
     using hHalfedge = Polyhedron::Halfedge_handle;
     using hVertex = Polyhedron::Vertex_handle;
     using hFacet = Polyhedron::Facet_handle;
@@ -37,35 +45,6 @@ namespace
     using Triangle = Polyhedron::Triangle;
     using Edge = Polyhedron::Edge;
 
-    std::vector<hVertex> ConnectedComponent(hVertex hv, const Polyhedron &mesh, std::unordered_set<hVertex> &processed_set)
-    {
-        std::unordered_set<hVertex> vertices;
-
-        vertices.insert(hv);
-        processed_set.insert(hv);
-
-        bool found = true;
-        while (found)
-        {
-            found = false;
-            auto temp = vertices;
-            for (auto v : temp)
-            {
-                for (auto nei : CGAL::vertices_around_target(v, mesh))
-                {
-                    if (!processed_set.contains(nei))
-                    {
-                        vertices.insert(nei);
-                        processed_set.insert(nei);
-                        found = true;
-                    }
-                }
-            }
-        }
-
-        return std::vector<hVertex>(vertices.begin(), vertices.end());
-    }
-
     std::vector<Point_3> Resample(const std::vector<Point_3> &split_points, double threshold)
     {
         std::vector<Point_3> new_points;
@@ -220,15 +199,13 @@ void ReSegmentOneLabel(const Polyhedron &mesh, const AABBTree &aabb_tree, const
     std::unordered_set<hFacet> all_intersect_faces;
     for (auto &split_points : split_points_list)
     {
-        std::vector<KernelEpick::Point_3> project_points;
+        std::vector<KernelEpick::Point_3> project_points(split_points.size());
+        std::vector<hFacet> project_facets(split_points.size());
+        BatchClosestPoints(aabb_tree, std::span<const Point_3>(split_points), std::span<Point_3>(project_points), std::span<hFacet>(project_facets));
         std::vector<KernelEpick::Vector_3> normals;
-        std::vector<hFacet> project_facets;
-        for (auto &pt : split_points)
+        for (auto hf : project_facets)
         {
-            auto [p, hf] = aabb_tree.closest_point_and_primitive(pt);
-            project_points.push_back(p);
             normals.push_back(FaceNormal(hf));
-            project_facets.push_back(hf);
         }
 
         // smooth the normals
@@ -308,25 +285,28 @@ void ReSegmentOneLabel(const Polyhedron &mesh, const AABBTree &aabb_tree, const
         ofs.close();
     }
 #endif
-    std::unordered_set<hVertex> processed_set;
+    std::vector<char> on_cut(mesh.size_of_vertices(), 0);
 #pragma omp critical
     {
         for (auto hf : all_intersect_faces)
         {
             for (auto hv : CGAL::vertices_around_face(hf->halfedge(), mesh))
             {
-                processed_set.insert(hv);
+                on_cut[hv->id()] = 1;
                 output_labels[hv->id()] = label;
             }
         }
     }
 
+    // components of the mesh with the cut removed
+    const std::vector<hVertex> all_vertices(CGAL::vertices(mesh).begin(), CGAL::vertices(mesh).end());
+    auto groups = VertexComponents(mesh, [&](hVertex v0, hVertex v1) { return !on_cut[v0->id()] && !on_cut[v1->id()]; }).Group(all_vertices);
     std::vector<std::vector<hVertex>> connected_components;
-    for (auto hv : CGAL::vertices(mesh))
+    for (auto &group : groups)
     {
-        if (!processed_set.contains(hv))
+        if (!on_cut[group.front()->id()])
         {
-            connected_components.push_back(ConnectedComponent(hv, mesh, processed_set));
+            connected_components.push_back(std::move(group));
         }
     }
 
@@ -369,8 +349,14 @@ bool ReSegmentLabels(
     int cutface_orit_smooth,
     bool upper)
 {
+    ORTHO_PROFILE_SCOPE("resegment");
     Polyhedron mesh;
-    if(CGAL::IO::read_polygon_mesh(input_mesh, mesh, CGAL::parameters::verbose(true)))
+    bool loaded = false;
+    {
+        ORTHO_PROFILE_SCOPE("load");
+        loaded = CGAL::IO::read_polygon_mesh(input_mesh, mesh, CGAL::parameters::verbose(true));
+    }
+    if(loaded)
     {
         printf("Load mesh: V = %zd, F = %zd\n", mesh.size_of_vertices(), mesh.size_of_facets());
     }
@@ -392,12 +378,17 @@ bool ReSegmentLabels(
     }
     CGAL::set_halfedgeds_items_id(mesh);
 
+#ifdef ORTHO_FLAT_BVH
+    AABBTree aabb_tree = CachedFlatBVH(mesh);
+#else
     AABBTree aabb_tree(mesh.facets_begin(), mesh.facets_end(), mesh);
+#endif
     if(aabb_tree.empty())
     {
         std::cout << "Error: failed to create AABB tree." << std::endl;
         return false;
     }
+    PrepareForProjection(aabb_tree);
     std::vector<int> output_labels(mesh.size_of_vertices(), 0);
 
     std::vector<int> indices_to_process;
@@ -408,13 +399,17 @@ bool ReSegmentLabels(
         if (!upper && splitline_labels[i] > 30)
             indices_to_process.push_back(i);
     }
-#pragma omp parallel for
-    for (int i = 0; i < indices_to_process.size(); i++)
     {
-        int idx = indices_to_process[i];
-        ReSegmentOneLabel(mesh, aabb_tree, splitlines[idx], output_labels, splitline_labels[idx], intersection_width, cutface_orit_smooth);
+        ORTHO_PROFILE_SCOPE("cut");
+#pragma omp parallel for
+        for (int i = 0; i < indices_to_process.size(); i++)
+        {
+            int idx = indices_to_process[i];
+            ReSegmentOneLabel(mesh, aabb_tree, splitlines[idx], output_labels, splitline_labels[idx], intersection_width, cutface_orit_smooth);
+        }
     }
 
+    ORTHO_PROFILE_SCOPE("write");
     nlohmann::json json;
     json["labels"] = output_labels;
     std::ofstream ofs(output_json);
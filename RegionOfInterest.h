@@ -0,0 +1,80 @@
+#ifndef REGION_OF_INTEREST_H
+#define REGION_OF_INTEREST_H
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <queue>
+#include <utility>
+#include <vector>
+#include <CGAL/boost/graph/iterator.h>
+
+// Faces of mesh within width of the borders between face labels. The band grows along the edges from the
+// border vertices; a vertex is kept if its distance along the edges (geodesic) or its straight distance to the
+// border vertex it was reached from (Euclidean) is below width. Stages that only look near the label borders
+// can build their spatial trees on these faces alone. They are faces of mesh, so results keep the original
+// ids. Vertex ids and face labels must be set.
+template <typename Polyhedron>
+std::vector<typename Polyhedron::Facet_handle> LabelBorderBand(Polyhedron& mesh, double width, bool geodesic)
+{
+    using Point_3 = typename Polyhedron::Point_3;
+    using hVertex = typename Polyhedron::Vertex_handle;
+
+    const std::vector<hVertex> vertices(mesh.vertices_begin(), mesh.vertices_end());
+    std::vector<double> dist(vertices.size(), std::numeric_limits<double>::max());
+    std::vector<Point_3> source(vertices.size());
+    using Item = std::pair<double, size_t>;
+    std::priority_queue<Item, std::vector<Item>, std::greater<Item>> queue;
+    for(auto hv : vertices)
+    {
+        int label = -1;
+        for(auto hf : CGAL::faces_around_target(hv->halfedge(), mesh))
+        {
+            if(hf == nullptr)
+                continue;
+            if(label != -1 && hf->_label != label)
+            {
+                dist[hv->id()] = 0.0;
+                source[hv->id()] = hv->point();
+                queue.emplace(0.0, hv->id());
+                break;
+            }
+            label = hf->_label;
+        }
+    }
+
+    while(!queue.empty())
+    {
+        auto [d, v] = queue.top();
+        queue.pop();
+        if(d > dist[v])
+            continue;
+        for(auto hh : CGAL::halfedges_around_target(vertices[v]->halfedge(), mesh))
+        {
+            size_t nei = hh->opposite()->vertex()->id();
+            double nd = geodesic ? d + std::sqrt(CGAL::squared_distance(vertices[v]->point(), vertices[nei]->point()))
+                                 : std::sqrt(CGAL::squared_distance(source[v], vertices[nei]->point()));
+            if(nd < width && nd < dist[nei])
+            {
+                dist[nei] = nd;
+                source[nei] = source[v];
+                queue.emplace(nd, nei);
+            }
+        }
+    }
+
+    std::vector<typename Polyhedron::Facet_handle> faces;
+    for(auto hf = mesh.facets_begin(); hf != mesh.facets_end(); hf++)
+    {
+        for(auto hv : CGAL::vertices_around_face(hf->halfedge(), mesh))
+        {
+            if(dist[hv->id()] < width)
+            {
+                faces.push_back(hf);
+                break;
+            }
+        }
+    }
+    return faces;
+}
+
+#endif
@@ -1,4 +1,3 @@
-#include <deque>
 #include <iostream>
 #include <vector>
 #include <CGAL/boost/graph/io.h>
@@ -6,6 +5,9 @@
 #include <CGAL/version.h>
 #include <nlohmann/json.hpp>
 #include "../Polyhedron.h"
+#include "../Components.h"
+#include "../LabelTransfer.h"
+#include "../Profiler.h"
 #ifdef FOUND_PYBIND11
 #include <pybind11/pybind11.h>
 #endif
@@ -39,6 +41,7 @@ namespace
         std::string output;
         std::string labels;
         std::string outmesh;
+        std::string trace;
         int size_threshold;
     };
 
@@ -67,63 +70,17 @@ namespace
             {
                 cfg.size_threshold = std::atoi(argv[i + 1]);
             }
-        }
-        return cfg;
-    }
-
-    std::vector<hVertex> ConnectedComponents(hVertex hv, Polyhedron &mesh)
-    {
-        std::vector<hVertex> vertices;
-        std::deque<hVertex> front;
-        front.push_back(hv);
-        vertices.push_back(hv);
-        hv->_processed = true;
-
-        while (!front.empty())
-        {
-            hVertex v = front.front();
-            front.pop_front();
-            for (auto nei : CGAL::vertices_around_target(v, mesh))
+            else if (std::strcmp(argv[i], "-trace") == 0)
             {
-                if (!nei->_processed && nei->_label == hv->_label)
-                {
-                    front.push_back(nei);
-                    vertices.push_back(nei);
-                    nei->_processed = true;
-                }
+                cfg.trace = std::string(argv[i + 1]);
             }
         }
-
-        return vertices;
+        return cfg;
     }
 
     void CleanSmallComponents(const std::vector<hVertex> &component, Polyhedron &mesh)
     {
-        std::vector<hVertex> surroundings;
-
-        for (auto hv : component)
-        {
-            for (auto nei : CGAL::vertices_around_target(hv, mesh))
-            {
-                if (nei->_label != hv->_label)
-                    surroundings.push_back(nei);
-            }
-        }
-
-        if (surroundings.empty())
-        {
-            return;
-        }
-
-        for (auto hv : component)
-        {
-            auto p = hv->point();
-            auto nearest = *std::min_element(surroundings.begin(), surroundings.end(),
-                                             [&](hVertex nei0, hVertex nei1)
-                                             { return CGAL::squared_distance(p, nei0->point()) < CGAL::squared_distance(p, nei1->point()); });
-
-            hv->_label = nearest->_label;
-        }
+        TransferLabelsFromSurroundings(mesh, component, [](hVertex hv, hVertex nei) { return nei->_label != hv->_label; });
     }
 }
 
@@ -131,7 +88,12 @@ bool SegClean(std::string input_mesh, std::string input_labels, std::string outp
 {
     // Config cfg = LoadConfig(argc, argv);
     Polyhedron mesh;
-    if(CGAL::IO::read_polygon_mesh(input_mesh, mesh))
+    bool loaded = false;
+    {
+        ORTHO_PROFILE_SCOPE("load");
+        loaded = CGAL::IO::read_polygon_mesh(input_mesh, mesh);
+    }
+    if(loaded)
     {
         printf("Load mesh: V = %zd, F = %zd\n", mesh.size_of_vertices(), mesh.size_of_facets());
     }
@@ -151,14 +113,16 @@ bool SegClean(std::string input_mesh, std::string input_labels, std::string outp
 
     mesh.LoadLabels(input_labels);
 
+    ORTHO_PROFILE_SCOPE("seg_clean");
     std::cout << "Find connected components...";
+    CGAL::set_halfedgeds_items_id(mesh);
+    const std::vector<hVertex> all_vertices(mesh.vertices_begin(), mesh.vertices_end());
+    auto groups = VertexComponents(mesh, [](hVertex v0, hVertex v1) { return v0->_label == v1->_label; }).Group(all_vertices);
     std::vector<std::pair<int, std::vector<hVertex>>> connected_components;
-    for (auto hv : CGAL::vertices(mesh))
+    for (auto &group : groups)
     {
-        if (!hv->_processed)
-        {
-            connected_components.emplace_back(hv->_label, ConnectedComponents(hv, mesh));
-        }
+        int label = group.front()->_label;
+        connected_components.emplace_back(label, std::move(group));
     }
     if(connected_components.empty())
     {
@@ -203,6 +167,7 @@ bool SegClean(std::string input_mesh, std::string input_labels, std::string outp
 int main(int argc, char *argv[])
 {
     Config cfg = LoadConfig(argc, argv);
+    Profiler::Session session(cfg.trace);
     SegClean(cfg.input, cfg.labels, cfg.output, cfg.size_threshold);
     return 0;
 }
@@ -1,12 +1,25 @@
+#include <cstdio>
+#include <mutex>
 #include "print.h"
 
+namespace {
+  std::mutex gPrintMutex;
+}
+
 #ifdef FOUND_PYBIND11
 #include <pybind11/embed.h>
 
 namespace py = pybind11;
 
+// Threads without the GIL, like OpenMP workers, cannot call into python and write to stdout instead.
 void printInTqdm(const char* str)
 {
+  if (!PyGILState_Check()) {
+    std::lock_guard<std::mutex> lock(gPrintMutex);
+    fputs(str, stdout);
+    fflush(stdout);
+    return;
+  }
   py::module_ tqdm = py::module_::import("tqdm");
   py::object tqdm_write = tqdm.attr("tqdm").attr("write");
   tqdm_write(str);
@@ -14,12 +27,17 @@ void printInTqdm(const char* str)
 #else
 void printInTqdm(const char* str)
 {
-  std::cout << str;
+  std::lock_guard<std::mutex> lock(gPrintMutex);
+  fputs(str, stdout);
 }
 #endif
 
+namespace {
+  thread_local callback_streambuf tqdm_buf(printInTqdm);
+}
+
 namespace std {
-  std::ostream tqdm_cout(new callback_streambuf(printInTqdm));
+  thread_local std::ostream tqdm_cout(&tqdm_buf);
 }
 
 void printInTqdmFormat(const char* format, ...)
@@ -27,7 +45,7 @@ void printInTqdmFormat(const char* format, ...)
   va_list args;
   va_start(args, format);
   char buffer[1024];
-  vsprintf(buffer, format, args);
+  vsnprintf(buffer, sizeof(buffer), format, args);
   va_end(args);
   printInTqdm(buffer);
 }
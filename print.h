@@ -4,6 +4,7 @@
 #include <iostream>
 #include <stdarg.h>
 #include <functional>
+#include <string>
 
 #define printf(...) printInTqdmFormat(__VA_ARGS__)
 #define cout tqdm_cout
@@ -16,17 +17,21 @@ public:
   callback_streambuf(std::function<void(char const*)> callback) : callback(callback) {}
 
 protected:
+  // Lines are passed to the callback once complete.
   std::streamsize xsputn(char_type const* s, std::streamsize count) {
-    std::string str(s, s + count);
-    size_t pos = str.find('\n');
-    if (pos != std::string::npos) {
-      std::string line = str.substr(0, pos + 1);
-      callback(line.c_str());
-      str = str.substr(pos + 1);
-    }
+    str.append(s, s + count);
+    flushLines();
     return count;
   }
 
+  int_type overflow(int_type ch) {
+    if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+      str.push_back(traits_type::to_char_type(ch));
+      flushLines();
+    }
+    return traits_type::not_eof(ch);
+  }
+
   int sync() {
     if (!str.empty()) {
       callback(str.c_str());
@@ -36,12 +41,21 @@ protected:
   }
 
 private:
+  void flushLines() {
+    size_t pos;
+    while ((pos = str.find('\n')) != std::string::npos) {
+      callback(str.substr(0, pos + 1).c_str());
+      str.erase(0, pos + 1);
+    }
+  }
+
   std::function<void(char const*)> callback;
   std::string str;
 };
 
+// One stream per thread, so lines written from parallel regions are not mixed.
 namespace std {
-  std::ostream extern tqdm_cout;
+  extern thread_local std::ostream tqdm_cout;
 }
 
 #endif
\ No newline at end of file